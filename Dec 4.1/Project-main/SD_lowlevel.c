@@ -1,45 +1,130 @@
 #include "SD_lowlevel.h"
 #include "STM32L432KC_SPI.h"
+#include "timer.h"
+#include "stm32l432xx.h"
 #include <stdint.h>
 
 // SD commands
 #define CMD0    (0x40+0)
+#define CMD6    (0x40+6)
 #define CMD8    (0x40+8)
+#define CMD9    (0x40+9)
+#define CMD10   (0x40+10)
+#define CMD12   (0x40+12)
 #define CMD17   (0x40+17)
+#define CMD13   (0x40+13)
+#define CMD18   (0x40+18)
 #define CMD24   (0x40+24)
+#define CMD25   (0x40+25)
 #define CMD55   (0x40+55)
 #define CMD58   (0x40+58)
+#define ACMD13  (0x40+13)
+#define ACMD23  (0x40+23)
 #define ACMD41  (0x40+41)
 
 #define TOKEN_START 0xFE
-
-#define CARD_UNKNOWN 0
-#define CARD_SD1     1
-#define CARD_SD2     2
-#define CARD_SDHC    3
+#define TOKEN_MULTI 0xFC    // CMD25 data block
+#define TOKEN_STOP  0xFD    // CMD25 stop tran
 
 static uint8_t cardType = CARD_UNKNOWN;
 
+#ifndef PLAYBACK_ONLY
+// Last write still programming; checked before the next command
+static uint8_t writeBusy = 0;
+#endif
+
+// Card registers read once at init
+static SD_CardInfo cardInfo;
+
+// Negotiated SPI3 clock
+static SPI_BaudRate spiBaud = SPI_BR_8;
+static uint32_t spiClockHz = 0;
+
+// In-flight asynchronous read request
+#define REQ_IDLE    0
+#define REQ_TOKEN   1   // waiting for the start token
+#define REQ_DATA    2   // 512-byte payload on DMA
+
+static struct {
+    uint8_t  state;
+    uint8_t  status;
+    uint8_t  multi;
+    uint8_t  retries;   // CRC retries left for this request
+    uint32_t addr;      // card address of the next block
+    uint8_t* buf;
+    uint32_t left;
+    uint32_t start;     // DWT time the token wait began
+    SD_Callback done;
+} req;
+
+static uint32_t crcErrors = 0;
+
+// Phase timing of the last SD_Init()
+static SD_InitStats initStats;
+
 static uint8_t SD_SendCommand(uint8_t cmd, uint32_t arg, uint8_t crc);
-static uint8_t SD_WaitReady(void);
-static void SD_ClockOut(uint32_t clocks);
+static uint8_t SD_WaitReady(uint32_t ms);
+#ifndef PLAYBACK_ONLY
+static uint8_t SD_TxDataBlock(uint8_t token, const uint8_t* buf);
+#endif
+static void SD_ClockOut(uint32_t bytes);
+static void SD_ReqFinish(uint8_t status);
+static uint8_t SD_ReqIssue(void);
+static void SD_ReqAbort(void);
+static uint8_t SD_StopTransmission(void);
+static uint8_t SD_ReadRegister(uint8_t cmd, uint32_t arg, uint8_t* buf, uint16_t len);
+static uint8_t SD_RxRegister(uint8_t* buf, uint16_t len);
+static void SD_ReadCardInfo(void);
+static void SD_SelectClock(void);
+static void SD_SetBaud(SPI_BaudRate br);
+static uint32_t SD_Pclk1(void);
+static SPI_BaudRate SD_InitBaud(void);
+static uint8_t SD_WaitInitialized(uint32_t arg);
+static void SD_PhaseDone(uint8_t phase, uint32_t* t);
+static uint8_t SD_InitFail(uint8_t phase, uint8_t status);
 
 uint8_t SD_Init(void) {
     uint8_t r;
     uint8_t ocr[4];
-
-    // Init SPI3 slow (fPCLK/256)
-    initSPI3(SPI_BR_256, 0, 0);
-
-    // Send 80 clocks with CS high
+    uint32_t t0, t;
+    SD_CardInfo blank = {0};
+    SD_InitStats blankStats = {0};
+
+    cardType = CARD_UNKNOWN;
+#ifndef PLAYBACK_ONLY
+    writeBusy = 0;
+#endif
+    cardInfo = blank;
+    initStats = blankStats;
+    initStats.failed = SD_PHASES;
+
+    DWT_Init();
+    t0 = t = DWT_Now();
+
+    // Init SPI3 at the fastest clock the card accepts before ACMD41
+    SD_SetBaud(SD_InitBaud());
+    initStats.init_clock_hz = spiClockHz;
+
+    // >= 74 clocks with CS high
     SD_Deselect();
-    SD_ClockOut(80);
+    SD_ClockOut(10);
+    SD_PhaseDone(SD_PHASE_POWERUP, &t);
 
     //----------------------------------------------
     // CMD0 — reset
     //----------------------------------------------
-    if (SD_SendCommand(CMD0, 0, 0x95) != 1)
-        return SD_ERROR;
+    do {
+        r = SD_SendCommand(CMD0, 0, 0x95);
+        initStats.cmd0_tries++;
+        if (r != 1) {
+            SD_Deselect();
+            SD_ClockOut(10);
+        }
+    } while (r != 1 && initStats.cmd0_tries < SD_CMD0_RETRIES);
+
+    if (r != 1)
+        return SD_InitFail(SD_PHASE_CMD0, SD_ERROR);
+    SD_PhaseDone(SD_PHASE_CMD0, &t);
 
     //----------------------------------------------
     // CMD8 — check SD2 / voltage range
@@ -50,21 +135,23 @@ uint8_t SD_Init(void) {
         for(int i=0;i<4;i++) ocr[i] = SD_SPI_Receive();
 
         if (ocr[2] != 0x01 || ocr[3] != 0xAA)
-            return SD_ERROR; // invalid voltage
+            return SD_InitFail(SD_PHASE_CMD8, SD_ERROR); // invalid voltage
+        SD_PhaseDone(SD_PHASE_CMD8, &t);
 
         //------------------------------------------
         // ACMD41 with HCS bit
         //------------------------------------------
-        do {
-            SD_SendCommand(CMD55,0,0x01);
-            r = SD_SendCommand(ACMD41, 0x40000000, 0x01);
-        } while (r != 0);
+        if (SD_WaitInitialized(0x40000000) != SD_OK)
+            return SD_InitFail(SD_PHASE_ACMD41, SD_TIMEOUT);
+        SD_PhaseDone(SD_PHASE_ACMD41, &t);
 
         //------------------------------------------
         // CMD58 — read OCR
         //------------------------------------------
-        SD_SendCommand(CMD58,0,0x01);
+        if (SD_SendCommand(CMD58,0,0x01) != 0)
+            return SD_InitFail(SD_PHASE_CMD58, SD_ERROR);
         for(int i=0;i<4;i++) ocr[i] = SD_SPI_Receive();
+        for(int i=0;i<4;i++) cardInfo.ocr[i] = ocr[i];
 
         if (ocr[0] & 0x40)
             cardType = CARD_SDHC;
@@ -75,79 +162,552 @@ uint8_t SD_Init(void) {
         //------------------------------------------
         // SD v1 or MMC
         //------------------------------------------
-        do {
-            SD_SendCommand(CMD55,0,0x01);
-            r = SD_SendCommand(ACMD41,0,0x01);
-        } while (r != 0);
+        SD_PhaseDone(SD_PHASE_CMD8, &t);
+
+        if (SD_WaitInitialized(0) != SD_OK)
+            return SD_InitFail(SD_PHASE_ACMD41, SD_TIMEOUT);
+        SD_PhaseDone(SD_PHASE_ACMD41, &t);
 
         cardType = CARD_SD1;
+
+        SD_SendCommand(CMD58,0,0x01);
+        for(int i=0;i<4;i++) cardInfo.ocr[i] = SD_SPI_Receive();
     }
 
     SD_Deselect();
     SD_SPI_Receive();
+    SD_PhaseDone(SD_PHASE_CMD58, &t);
 
     //----------------------------------------------
-    // Now switch SPI to full speed (10 MHz)
+    // Known-good 10 MHz first, then step up as far
+    // as the card (CSD / CMD6) and a read test allow
     //----------------------------------------------
-    initSPI3(SPI_BR_8, 0, 0);   // 80 MHz / 8 = 10 MHz
+    SD_SetBaud(SPI_BR_8);   // 80 MHz / 8 = 10 MHz
+
+#if SD_USE_DMA
+    initSPI3_DMA();
+#endif
 
+    SD_ReadCardInfo();
+    SD_SelectClock();
+    SD_PhaseDone(SD_PHASE_SPEED, &t);
+
+    initStats.total_us = DWT_ElapsedUs(t0);
     return SD_OK;
 }
 
+const SD_InitStats* SD_GetInitStats(void) {
+    return &initStats;
+}
+
+// Fastest prescaler whose SCK stays at or below SD_INIT_CLOCK_HZ
+static SPI_BaudRate SD_InitBaud(void) {
+    SPI_BaudRate br = SPI_BR_2;
+    while (br < SPI_BR_256 && (SD_Pclk1() >> (br + 1)) > SD_INIT_CLOCK_HZ)
+        br++;
+    return br;
+}
+
+// ACMD41 until the card leaves idle, bounded by SD_INIT_TIMEOUT_MS
+static uint8_t SD_WaitInitialized(uint32_t arg) {
+    uint32_t start = DWT_Now();
+    uint8_t r;
+
+    do {
+        SD_SendCommand(CMD55,0,0x01);
+        r = SD_SendCommand(ACMD41, arg, 0x01);
+        initStats.acmd41_polls++;
+        if (r == 0)
+            return SD_OK;
+    } while (DWT_ElapsedUs(start) < SD_INIT_TIMEOUT_MS * 1000UL);
+
+    return SD_TIMEOUT;
+}
+
+static void SD_PhaseDone(uint8_t phase, uint32_t* t) {
+    uint32_t now = DWT_Now();
+    initStats.phase_us[phase] = DWT_ElapsedUs(*t);
+    *t = now;
+}
+
+static uint8_t SD_InitFail(uint8_t phase, uint8_t status) {
+    SD_Deselect();
+    initStats.failed = phase;
+    return status;
+}
+
+//--------------------------------------------------
+// Synchronous reads: submit to the request engine
+// below and poll it to completion.
+//--------------------------------------------------
 uint8_t SD_ReadBlock(uint32_t sector, uint8_t* buf) {
-    if (cardType != CARD_SDHC) sector *= 512;
+    return SD_ReadMultiBlock(sector, buf, 1);
+}
 
-    if (SD_SendCommand(CMD17, sector, 0x01) != 0) {
-        SD_Deselect();
+uint8_t SD_ReadMultiBlock(uint32_t sector, uint8_t* buf, uint32_t count) {
+    uint8_t r;
+
+    SD_AsyncWait();
+
+    for (;;) {
+        while ((r = SD_ReadAsync(sector, buf, count, 0)) == SD_BUSY);
+        if (r == SD_OK)
+            while ((r = SD_Poll()) == SD_BUSY);
+
+        // Failed above the 10 MHz baseline: drop one step and retry
+        if (r == SD_OK || SD_StepDown() != SD_OK)
+            return r;
+    }
+}
+
+//--------------------------------------------------
+// Asynchronous read requests
+//
+// CMD17 (one sector) or CMD18 (a run, stopped with
+// CMD12) is issued at submit time; SD_Poll() then
+// walks token wait -> data -> next block -> stop,
+// never spinning more than SD_POLL_PROBES bytes on
+// a busy card.
+//--------------------------------------------------
+uint8_t SD_ReadAsync(uint32_t sector, uint8_t* buf, uint32_t count, SD_Callback done) {
+    if (req.state != REQ_IDLE)
+        return SD_BUSY;
+#ifndef PLAYBACK_ONLY
+    if (SD_WriteBusy())
+        return SD_BUSY;
+#endif
+    if (count == 0)
+        return SD_ERROR;
+
+    req.addr    = (cardType != CARD_SDHC) ? sector * 512 : sector;
+    req.buf     = buf;
+    req.left    = count;
+    req.retries = SD_CRC_RETRIES;
+    req.done    = done;
+
+    if (SD_ReqIssue() != SD_OK)
         return SD_ERROR;
+
+    req.status = SD_BUSY;
+    req.state  = REQ_TOKEN;
+    return SD_OK;
+}
+
+uint8_t SD_Poll(void) {
+    switch (req.state) {
+
+    case REQ_IDLE:
+        return req.status;
+
+    case REQ_TOKEN: {
+        uint8_t token = 0xFF;
+        for (int i=0; i<SD_POLL_PROBES && token == 0xFF; i++)
+            token = SD_SPI_Receive();
+        if (token == 0xFF) {
+            if (DWT_ElapsedUs(req.start) >= SD_READ_TIMEOUT_MS * 1000UL) {
+                SD_ReqFinish(SD_TIMEOUT);
+                return req.status;
+            }
+            return SD_BUSY;
+        }
+        if (token != TOKEN_START) {
+            SD_ReqFinish(SD_ERROR);
+            return req.status;
+        }
+
+#if SD_USE_CRC
+        spi3_crc_begin();
+#endif
+#if SD_USE_DMA
+        spi3_dma_start(req.buf, 0, 512, 0);
+        req.state = REQ_DATA;
+        return SD_BUSY;
+#else
+        for (int i=0;i<511;i++)
+            req.buf[i] = SD_SPI_Receive();
+#if SD_USE_CRC
+        req.buf[511] = spi3_transfer_crc_last(0xFF);
+#else
+        req.buf[511] = SD_SPI_Receive();
+#endif
+#endif
+    }
+    // fall through: polled data phase already done
+
+    case REQ_DATA: {
+        uint8_t bad = 0;
+#if SD_USE_DMA
+        if (spi3_dma_busy())
+            return SD_BUSY;
+        if (spi3_dma_wait()) {
+#if SD_USE_CRC
+            spi3_crc_end();
+#endif
+            SD_ReqFinish(SD_ERROR);
+            return req.status;
+        }
+#endif
+#if SD_USE_CRC
+        bad = spi3_crc_end();
+#else
+        SD_SPI_Receive(); // CRC
+        SD_SPI_Receive();
+#endif
+
+        if (bad) {
+            // Drop the stream and re-issue from the failed block
+            crcErrors++;
+            if (req.retries == 0) {
+                SD_ReqFinish(SD_CRC_ERROR);
+                return req.status;
+            }
+            req.retries--;
+            SD_ReqAbort();
+            if (SD_ReqIssue() != SD_OK) {
+                req.multi = 0;
+                SD_ReqFinish(SD_ERROR);
+                return req.status;
+            }
+            req.state = REQ_TOKEN;
+            return SD_BUSY;
+        }
+
+        req.buf += 512;
+        req.addr += (cardType != CARD_SDHC) ? 512 : 1;
+        if (--req.left == 0) {
+            SD_ReqFinish(SD_OK);
+            return req.status;
+        }
+        req.start = DWT_Now();
+        req.state = REQ_TOKEN;
+        return SD_BUSY;
+    }
     }
 
-    uint16_t t = 0xFFFF;
-    uint8_t token;
+    return req.status;
+}
 
-    do {
-        token = SD_SPI_Receive();
-    } while (token == 0xFF && --t);
+uint32_t SD_GetCrcErrors(void) {
+    return crcErrors;
+}
 
-    if (token != TOKEN_START)
-        return SD_TIMEOUT;
+int SD_AsyncBusy(void) {
+    return req.state != REQ_IDLE;
+}
 
-    for (int i=0;i<512;i++)
-        buf[i] = SD_SPI_Receive();
+void SD_AsyncWait(void) {
+    while (SD_Poll() == SD_BUSY);
+}
 
-    SD_SPI_Receive(); // CRC
-    SD_SPI_Receive();
+// CMD17 for the last block, CMD18 for a run, from req.addr
+static uint8_t SD_ReqIssue(void) {
+    req.multi  = (req.left > 1);
+    req.start  = DWT_Now();
 
-    SD_Deselect();
+    if (SD_SendCommand(req.multi ? CMD18 : CMD17, req.addr, 0x01) != 0) {
+        SD_Deselect();
+        return SD_ERROR;
+    }
     return SD_OK;
 }
 
+// Stop a CMD18 run and release the bus
+static void SD_ReqAbort(void) {
+    if (req.multi)
+        SD_StopTransmission();
+    SD_Deselect();
+}
+
+// Close out the request: stop a CMD18 run, release the
+// bus, then report to the submitter
+static void SD_ReqFinish(uint8_t status) {
+    if (req.multi && SD_StopTransmission() != SD_OK && status == SD_OK)
+        status = SD_ERROR;
+
+    SD_Deselect();
+
+    req.state  = REQ_IDLE;
+    req.status = status;
+    if (req.done)
+        req.done(status);
+}
+
+#ifndef PLAYBACK_ONLY
+//--------------------------------------------------
+// Writes return as soon as the card has accepted the
+// data; its programming (busy) time is waited out
+// before the next command, or polled with
+// SD_WriteBusy() / finished with SD_Sync().
+//--------------------------------------------------
 uint8_t SD_WriteBlock(uint32_t sector, const uint8_t* buf) {
 
+    SD_AsyncWait();
+
     if (cardType != CARD_SDHC) sector *= 512;
 
-    if (SD_SendCommand(CMD24, sector, 0x01) != 0) 
+    if (SD_SendCommand(CMD24, sector, 0x01) != 0) {
+        SD_Deselect();
         return SD_ERROR;
+    }
 
-    SD_SPI_Transmit(TOKEN_START);
+    uint8_t res = SD_TxDataBlock(TOKEN_START, buf);
 
-    for (int i=0;i<512;i++)
-        SD_SPI_Transmit(buf[i]);
+    writeBusy = 1;
+    SD_Deselect();
+    return res;
+}
 
-    SD_SPI_Transmit(0xFF);
-    SD_SPI_Transmit(0xFF);
+//--------------------------------------------------
+// Multi-block write: ACMD23 pre-erase count, CMD25,
+// one 0xFC-token block per sector, stop tran token.
+// A block the card rejects ends the run with CMD12
+// instead; a card that rejects ACMD23 gets the
+// blocks one CMD24 at a time.
+//--------------------------------------------------
+uint8_t SD_WriteMultiBlock(uint32_t sector, const uint8_t* buf, uint32_t count) {
+    uint8_t res = SD_OK;
 
-    uint8_t resp = SD_SPI_Receive();
-    if ((resp & 0x1F) != 0x05)
+    if (count == 1)
+        return SD_WriteBlock(sector, buf);
+
+    SD_AsyncWait();
+
+    // Lets the card erase the whole run up front
+    if (SD_SendCommand(CMD55, 0, 0x01) > 1 || SD_SendCommand(ACMD23, count, 0x01) != 0) {
+        SD_Deselect();
+        for (; count && res == SD_OK; count--, sector++, buf += 512)
+            res = SD_WriteBlock(sector, buf);
+        return res;
+    }
+
+    if (cardType != CARD_SDHC) sector *= 512;
+
+    if (SD_SendCommand(CMD25, sector, 0x01) != 0) {
+        SD_Deselect();
         return SD_ERROR;
+    }
 
-    if (SD_WaitReady())
-        return SD_TIMEOUT;
+    while (count--) {
+        res = SD_TxDataBlock(TOKEN_MULTI, buf);
+        if (res != SD_OK)
+            break;
+        buf += 512;
+    }
+
+    if (res != SD_OK) {
+        // Error data response: the spec wants CMD12, not stop tran
+        SD_WaitReady(SD_BUSY_TIMEOUT_MS);
+        SD_SendCommand(CMD12, 0, 0x01);
+        SD_WaitReady(SD_BUSY_TIMEOUT_MS);
+        SD_Deselect();
+        return res;
+    }
+
+    // Stop tran once the last block is in; the card then goes busy
+    if (SD_WaitReady(SD_BUSY_TIMEOUT_MS) != SD_OK)
+        res = SD_TIMEOUT;
+    SD_SPI_Transmit(TOKEN_STOP);
+    SD_SPI_Receive();
 
+    writeBusy = 1;
     SD_Deselect();
+    return res;
+}
+
+// Non-blocking: 1 while the card is still programming
+int SD_WriteBusy(void) {
+    if (!writeBusy || req.state != REQ_IDLE)
+        return writeBusy;
+
+    SD_Select();
+    if (SD_SPI_Receive() == 0xFF)
+        writeBusy = 0;
+    SD_Deselect();
+
+    return writeBusy;
+}
+
+// Block until every accepted write is programmed
+uint8_t SD_Sync(void) {
+    uint8_t res = SD_OK;
+
+    SD_AsyncWait();
+    if (writeBusy) {
+        SD_Select();
+        res = SD_WaitReady(SD_BUSY_TIMEOUT_MS);
+        SD_Deselect();
+        if (res == SD_OK)
+            writeBusy = 0;
+    }
+    return res;
+}
+#endif
+
+//--------------------------------------------------
+// Card registers and geometry
+//--------------------------------------------------
+
+static void SD_ReadCardInfo(void) {
+    cardInfo.type = cardType;
+    cardInfo.valid =
+        SD_ReadRegister(CMD9, 0, cardInfo.csd, 16) == SD_OK &&
+        SD_ReadRegister(CMD10, 0, cardInfo.cid, 16) == SD_OK;
+
+    // ACMD13 answers with R2: skip its second byte before the data token
+    if (cardType != CARD_SD1) {
+        SD_SendCommand(CMD55, 0, 0x01);
+        if (SD_SendCommand(ACMD13, 0, 0x01) == 0) {
+            SD_SPI_Receive();
+            SD_RxRegister(cardInfo.sdstat, 64);
+        }
+        SD_Deselect();
+    }
+}
+
+const SD_CardInfo* SD_GetCardInfo(void) {
+    return &cardInfo;
+}
+
+uint8_t SD_GetCardType(void) {
+    return cardType;
+}
+
+// Capacity in 512-byte sectors, from CSD v1 or v2
+uint32_t SD_GetSectorCount(void) {
+    const uint8_t* csd = cardInfo.csd;
+
+    if (!cardInfo.valid)
+        return 0;
+
+    if ((csd[0] >> 6) == 1) {
+        uint32_t csize = ((uint32_t)(csd[7] & 0x3F) << 16) | ((uint32_t)csd[8] << 8) | csd[9];
+        return (csize + 1) << 10;
+    }
+
+    uint32_t csize = ((uint32_t)(csd[6] & 0x03) << 10) | ((uint32_t)csd[7] << 2) | (csd[8] >> 6);
+    uint8_t  mult  = ((csd[9] & 0x03) << 1) | (csd[10] >> 7);
+    uint8_t  bl    = csd[5] & 0x0F;
+    return (csize + 1) << (mult + 2 + bl - 9);
+}
+
+// Erase block in sectors: SD status AU_SIZE on v2 cards,
+// CSD SECTOR_SIZE x WRITE_BL_LEN on v1
+uint32_t SD_GetEraseBlock(void) {
+    static const uint32_t auSectors[16] = {
+        0, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192,
+        16384, 24576, 32768, 49152, 65536, 131072
+    };
+    const uint8_t* csd = cardInfo.csd;
+
+    if (cardType != CARD_SD1) {
+        uint32_t au = auSectors[cardInfo.sdstat[10] >> 4];
+        if (au)
+            return au;
+    }
+    if (!cardInfo.valid)
+        return 1;
+
+    uint32_t sectors = (((csd[10] & 0x3F) << 1) | (csd[11] >> 7)) + 1;
+    uint8_t  wbl = ((csd[12] & 0x03) << 2) | (csd[13] >> 6);
+    return (wbl > 9) ? sectors << (wbl - 9) : sectors;
+}
+
+//--------------------------------------------------
+// Clock negotiation
+//--------------------------------------------------
+
+uint32_t SD_GetClockHz(void) {
+    return spiClockHz;
+}
+
+uint8_t SD_StepDown(void) {
+    if (spiBaud >= SPI_BR_8)
+        return SD_ERROR;
+    SD_SetBaud(spiBaud + 1);
     return SD_OK;
 }
 
+// Max SPI clock the card allows, from CSD TRAN_SPEED and CMD6
+static uint32_t SD_MaxClockHz(void) {
+    static const uint8_t tranValue[16] = {
+        0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80
+    };
+    const uint8_t* csd = cardInfo.csd;
+    uint8_t sw[64];
+
+    if (!cardInfo.valid)
+        return 25000000;
+
+    // TRAN_SPEED: bits 2:0 unit (100 kbit/s .. 100 Mbit/s), 6:3 value x10
+    uint8_t ts = csd[3];
+    uint32_t hz = 10000;
+    for (int i=0; i<(ts & 7); i++) hz *= 10;
+    hz *= tranValue[(ts >> 3) & 0x0F];
+
+    // CMD6 high-speed: SD v2+ with command class 10 (switch)
+    uint16_t ccc = ((uint16_t)csd[4] << 4) | (csd[5] >> 4);
+    if (cardType != CARD_SD1 && (ccc & (1 << 10))) {
+
+        // Check mode first, then switch group 1 to function 1
+        if (SD_ReadRegister(CMD6, 0x00FFFFF1, sw, 64) == SD_OK &&
+            (sw[13] & 0x02) &&
+            SD_ReadRegister(CMD6, 0x80FFFFF1, sw, 64) == SD_OK &&
+            (sw[16] & 0x0F) == 1) {
+            hz = 50000000;
+        }
+    }
+    return hz;
+}
+
+// Reference-checked sector 0 read at the current clock
+static uint32_t SD_ProbeChecksum(uint8_t* buf, uint8_t* ok) {
+    uint32_t a = 1, b = 0;
+    uint32_t crcBefore = crcErrors;
+
+    // A clock that needed a CRC retry is not a pass
+    *ok = (SD_ReadMultiBlock(0, buf, 1) == SD_OK) && crcErrors == crcBefore;
+    for (int i=0;i<512;i++) {
+        a = (a + buf[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+static void SD_SelectClock(void) {
+    uint8_t buf[512];
+    uint8_t ok;
+
+    uint32_t maxHz = SD_MaxClockHz();
+    uint32_t ref = SD_ProbeChecksum(buf, &ok);
+    if (!ok)
+        return;
+
+    // Fastest prescaler first; keep the first one that reads back the
+    // same sector 0 as the 10 MHz baseline
+    for (SPI_BaudRate br = SPI_BR_2; br < SPI_BR_8; br++) {
+        if ((SD_Pclk1() >> (br + 1)) > maxHz)
+            continue;
+
+        SD_SetBaud(br);
+        if (SD_ProbeChecksum(buf, &ok) == ref && ok)
+            return;
+    }
+
+    SD_SetBaud(SPI_BR_8);
+}
+
+static void SD_SetBaud(SPI_BaudRate br) {
+    initSPI3(br, 0, 0);
+    spiBaud = br;
+    spiClockHz = SD_Pclk1() >> (br + 1);
+}
+
+// SPI3 sits on APB1
+static uint32_t SD_Pclk1(void) {
+    return SystemCoreClock >>
+        APBPrescTable[(RCC->CFGR & RCC_CFGR_PPRE1) >> RCC_CFGR_PPRE1_Pos];
+}
+
 //--------------------------------------------------
 
 static uint8_t SD_SendCommand(uint8_t cmd, uint32_t arg, uint8_t crc) {
@@ -155,6 +715,15 @@ static uint8_t SD_SendCommand(uint8_t cmd, uint32_t arg, uint8_t crc) {
     SD_Deselect();
     SD_Select();
 
+#ifndef PLAYBACK_ONLY
+    // Finish the previous write's busy period first
+    if (writeBusy) {
+        if (SD_WaitReady(SD_BUSY_TIMEOUT_MS) != SD_OK)
+            return 0xFF;
+        writeBusy = 0;
+    }
+#endif
+
     SD_SPI_Transmit(cmd);
     SD_SPI_Transmit(arg>>24);
     SD_SPI_Transmit(arg>>16);
@@ -171,16 +740,106 @@ static uint8_t SD_SendCommand(uint8_t cmd, uint32_t arg, uint8_t crc) {
     return r;
 }
 
-static uint8_t SD_WaitReady(void) {
-    uint16_t t = 0xFFFF;
-    while(--t) {
+// DO high (card not busy) within ms
+static uint8_t SD_WaitReady(uint32_t ms) {
+    uint32_t start = DWT_Now();
+    do {
         if (SD_SPI_Receive() == 0xFF)
             return SD_OK;
-    }
+    } while (DWT_ElapsedUs(start) < ms * 1000UL);
     return SD_TIMEOUT;
 }
 
-static void SD_ClockOut(uint32_t clocks) {
-    for(uint32_t i=0;i<clocks;i++)
+// 8 clocks per byte, MOSI high
+static void SD_ClockOut(uint32_t bytes) {
+    for(uint32_t i=0;i<bytes;i++)
         SD_SPI_Receive();
 }
+
+// CMD12 mid-stream: CS stays low, the stuff byte after the
+// command is discarded, then wait out the card's busy period
+static uint8_t SD_StopTransmission(void) {
+    SD_SPI_Transmit(CMD12);
+    SD_SPI_Transmit(0);
+    SD_SPI_Transmit(0);
+    SD_SPI_Transmit(0);
+    SD_SPI_Transmit(0);
+    SD_SPI_Transmit(0x01);
+    SD_SPI_Receive();
+
+    uint8_t r;
+    for(int i=0;i<10;i++) {
+        r = SD_SPI_Receive();
+        if (!(r & 0x80))
+            break;
+    }
+    if (r != 0)
+        return SD_ERROR;
+
+    return SD_WaitReady(SD_BUSY_TIMEOUT_MS);
+}
+
+// Command with a short data-block response (CSD, CID, CMD6 status)
+static uint8_t SD_ReadRegister(uint8_t cmd, uint32_t arg, uint8_t* buf, uint16_t len) {
+    uint8_t res;
+
+    if (SD_SendCommand(cmd, arg, 0x01) != 0) {
+        SD_Deselect();
+        return SD_ERROR;
+    }
+
+    res = SD_RxRegister(buf, len);
+    SD_Deselect();
+    return res;
+}
+
+// Token, len data bytes, CRC — CS is left to the caller
+static uint8_t SD_RxRegister(uint8_t* buf, uint16_t len) {
+    uint32_t start = DWT_Now();
+    uint8_t token;
+
+    do {
+        token = SD_SPI_Receive();
+    } while (token == 0xFF && DWT_ElapsedUs(start) < SD_READ_TIMEOUT_MS * 1000UL);
+
+    if (token != TOKEN_START)
+        return SD_TIMEOUT;
+
+    for (uint16_t i=0;i<len;i++)
+        buf[i] = SD_SPI_Receive();
+
+    SD_SPI_Receive(); // CRC
+    SD_SPI_Receive();
+
+    return SD_OK;
+}
+
+#ifndef PLAYBACK_ONLY
+// Wait out the previous block's busy, then token, 512 bytes,
+// dummy CRC and the card's data response
+static uint8_t SD_TxDataBlock(uint8_t token, const uint8_t* buf) {
+
+    if (SD_WaitReady(SD_BUSY_TIMEOUT_MS) != SD_OK)
+        return SD_TIMEOUT;
+
+    SD_SPI_Transmit(token);
+
+#if SD_USE_DMA
+    spi3_dma_start(0, buf, 512, 0);
+    if (spi3_dma_wait())
+        return SD_ERROR;
+#else
+    for (int i=0;i<512;i++)
+        SD_SPI_Transmit(buf[i]);
+#endif
+
+    SD_SPI_Transmit(0xFF);
+    SD_SPI_Transmit(0xFF);
+
+    uint8_t resp = SD_SPI_Receive();
+    if ((resp & 0x1F) != 0x05)
+        return SD_ERROR;
+
+    return SD_OK;
+}
+#endif
@@ -6,9 +6,118 @@
 #define SD_OK       0
 #define SD_ERROR    1
 #define SD_TIMEOUT  2
+#define SD_BUSY     3   // async request still in flight
+#define SD_CRC_ERROR 4  // data block CRC16 mismatch after all retries
+
+// Move 512-byte data phases with DMA (0 = polled spi3_transfer)
+#ifndef SD_USE_DMA
+#define SD_USE_DMA  1
+#endif
+
+// Check read data blocks with the SPI3 hardware CRC16 unit
+#ifndef SD_USE_CRC
+#define SD_USE_CRC  1
+#endif
+
+// Re-reads of a block that fails its CRC before giving up
+#ifndef SD_CRC_RETRIES
+#define SD_CRC_RETRIES 3
+#endif
+
+// Token probes per SD_Poll() call before yielding
+#ifndef SD_POLL_PROBES
+#define SD_POLL_PROBES 16
+#endif
+
+// Init clock ceiling: the fastest prescaler at or below this is used
+// until ACMD41 completes
+#ifndef SD_INIT_CLOCK_HZ
+#define SD_INIT_CLOCK_HZ 400000
+#endif
+
+// Card power-up (ACMD41) limit; the spec allows 1 s
+#ifndef SD_INIT_TIMEOUT_MS
+#define SD_INIT_TIMEOUT_MS 1000
+#endif
+
+// Data token wait after a read command (the spec allows 100 ms) and busy
+// wait after a write block or CMD12 (500 ms for SDXC)
+#ifndef SD_READ_TIMEOUT_MS
+#define SD_READ_TIMEOUT_MS 100
+#endif
+#ifndef SD_BUSY_TIMEOUT_MS
+#define SD_BUSY_TIMEOUT_MS 500
+#endif
+
+// CMD0 attempts: a card left mid-transfer by an MCU reset
+// may need a few before it answers idle
+#ifndef SD_CMD0_RETRIES
+#define SD_CMD0_RETRIES 8
+#endif
+
+// Card types (disk_ioctl MMC_GET_TYPE)
+#define CARD_UNKNOWN 0
+#define CARD_SD1     1
+#define CARD_SD2     2
+#define CARD_SDHC    3
+
+// Registers cached by SD_Init()
+typedef struct {
+    uint8_t type;
+    uint8_t valid;        // CSD/CID read successfully
+    uint8_t csd[16];
+    uint8_t cid[16];
+    uint8_t ocr[4];
+    uint8_t sdstat[64];   // ACMD13 SD status (SD v2+ only)
+} SD_CardInfo;
+
+// SD_Init() phases, in order
+#define SD_PHASE_POWERUP 0  // >= 74 clocks with CS high
+#define SD_PHASE_CMD0    1
+#define SD_PHASE_CMD8    2
+#define SD_PHASE_ACMD41  3
+#define SD_PHASE_CMD58   4
+#define SD_PHASE_SPEED   5  // registers, CMD6, clock selection
+#define SD_PHASES        6
+
+// Timing of the last SD_Init()
+typedef struct {
+    uint32_t phase_us[SD_PHASES];
+    uint32_t total_us;
+    uint32_t init_clock_hz;
+    uint16_t cmd0_tries;
+    uint16_t acmd41_polls;
+    uint8_t  failed;      // phase that failed, SD_PHASES if none
+} SD_InitStats;
+
+// Async completion callback, runs from SD_Poll() with the final status
+typedef void (*SD_Callback)(uint8_t status);
 
 uint8_t SD_Init(void);
 uint8_t SD_ReadBlock(uint32_t sector, uint8_t* buf);
+uint8_t SD_ReadMultiBlock(uint32_t sector, uint8_t* buf, uint32_t count);
+#ifndef PLAYBACK_ONLY     // Playback-only builds carry no write commands
 uint8_t SD_WriteBlock(uint32_t sector, const uint8_t* buf);
+uint8_t SD_WriteMultiBlock(uint32_t sector, const uint8_t* buf, uint32_t count);
+int SD_WriteBusy(void);
+uint8_t SD_Sync(void);
+#endif
+uint32_t SD_GetClockHz(void);
+// After a failed transfer: SPI3 one step slower, SD_ERROR once at the
+// 10 MHz baseline
+uint8_t SD_StepDown(void);
+const SD_CardInfo* SD_GetCardInfo(void);
+uint8_t SD_GetCardType(void);
+uint32_t SD_GetSectorCount(void);
+uint32_t SD_GetEraseBlock(void);
+uint32_t SD_GetCrcErrors(void);
+const SD_InitStats* SD_GetInitStats(void);
+
+// Asynchronous reads: submit, then call SD_Poll() until it stops
+// returning SD_BUSY (or wait for the callback)
+uint8_t SD_ReadAsync(uint32_t sector, uint8_t* buf, uint32_t count, SD_Callback done);
+uint8_t SD_Poll(void);
+int SD_AsyncBusy(void);
+void SD_AsyncWait(void);
 
 #endif
@@ -5,6 +5,12 @@
 // Dummy byte
 static const uint8_t DUMMY = 0xFF;
 
+// DMA transfer state (SPI3 on DMA2 CH1 = RX, CH2 = TX)
+static volatile uint8_t dma_busy = 0;
+static volatile uint8_t dma_error = 0;
+static void (*dma_done_cb)(void) = 0;
+static uint8_t dma_dummy_rx;
+
 void initSPI3(SPI_BaudRate br, int cpol, int cpha) {
 
     // Enable GPIOB and GPIOA (for CS pin)
@@ -65,6 +71,139 @@ uint8_t spi3_transfer(uint8_t byte) {
     return *(volatile uint8_t*)&SPI3->DR;
 }
 
+//--------------------------------------------------
+// SPI3 hardware CRC16 (x^16 + x^12 + x^5 + 1, the
+// SD data-block CRC). CRCEN may only change while
+// the SPI is disabled.
+//
+// The master also shifts out its own TX CRC after
+// the data (0x7FA1 for 512 x 0xFF), which a card
+// mid-CMD18 would take as a command start. MOSI
+// (PB5) is therefore parked high as a GPIO for the
+// whole receive phase.
+//--------------------------------------------------
+
+void spi3_crc_begin(void) {
+    while (SPI3->SR & SPI_SR_BSY);
+
+    GPIOB->BSRR = GPIO_BSRR_BS5;
+    GPIOB->MODER = (GPIOB->MODER & ~GPIO_MODER_MODER5) | GPIO_MODER_MODER5_0;
+
+    SPI3->CR1 &= ~SPI_CR1_SPE;
+    SPI3->CRCPR = 0x1021;
+    SPI3->CR1 |= SPI_CR1_CRCEN | SPI_CR1_CRCL;   // 16-bit CRC on 8-bit frames
+    SPI3->CR1 |= SPI_CR1_SPE;
+}
+
+// Last byte of a polled CRC phase: CRCNEXT goes right after it is queued
+uint8_t spi3_transfer_crc_last(uint8_t byte) {
+
+    while(!(SPI3->SR & SPI_SR_TXE));
+    *(volatile uint8_t*)&SPI3->DR = byte;
+    SPI3->CR1 |= SPI_CR1_CRCNEXT;
+
+    while(!(SPI3->SR & SPI_SR_RXNE));
+    return *(volatile uint8_t*)&SPI3->DR;
+}
+
+// Drain the two received CRC bytes, check CRCERR, switch CRC off.
+// Returns 1 when the block did not match its CRC.
+int spi3_crc_end(void) {
+
+    for (int i = 0; i < 2; i++) {
+        while(!(SPI3->SR & SPI_SR_RXNE));
+        (void)*(volatile uint8_t*)&SPI3->DR;
+    }
+    while (SPI3->SR & SPI_SR_BSY);
+
+    int err = (SPI3->SR & SPI_SR_CRCERR) ? 1 : 0;
+    SPI3->SR &= ~SPI_SR_CRCERR;
+
+    SPI3->CR1 &= ~SPI_CR1_SPE;
+    SPI3->CR1 &= ~(SPI_CR1_CRCEN | SPI_CR1_CRCL);
+    SPI3->CR1 |= SPI_CR1_SPE;
+
+    GPIOB->MODER = (GPIOB->MODER & ~GPIO_MODER_MODER5) | GPIO_MODER_MODER5_1;
+    return err;
+}
+
+//--------------------------------------------------
+// SPI3 DMA
+//--------------------------------------------------
+
+void initSPI3_DMA(void) {
+
+    RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN;
+
+    // Request 3 on CH1/CH2 = SPI3_RX / SPI3_TX
+    DMA2_CSELR->CSELR &= ~(DMA_CSELR_C1S | DMA_CSELR_C2S);
+    DMA2_CSELR->CSELR |=  (3 << DMA_CSELR_C1S_Pos) | (3 << DMA_CSELR_C2S_Pos);
+
+    DMA2_Channel1->CPAR = (uint32_t)&SPI3->DR;
+    DMA2_Channel2->CPAR = (uint32_t)&SPI3->DR;
+
+    NVIC_SetPriority(DMA2_Channel1_IRQn, 1);
+    NVIC_EnableIRQ(DMA2_Channel1_IRQn);
+}
+
+// Clock len bytes full-duplex. rx == 0 discards the received bytes,
+// tx == 0 sends 0xFF. done (may be 0) runs from the RX-complete IRQ.
+void spi3_dma_start(uint8_t* rx, const uint8_t* tx, uint16_t len, void (*done)(void)) {
+
+    dma_done_cb = done;
+    dma_error = 0;
+    dma_busy = 1;
+
+    DMA2_Channel1->CCR = 0;
+    DMA2_Channel2->CCR = 0;
+
+    // RX: peripheral -> memory, 8-bit, interrupt on complete/error
+    DMA2_Channel1->CMAR  = rx ? (uint32_t)rx : (uint32_t)&dma_dummy_rx;
+    DMA2_Channel1->CNDTR = len;
+    DMA2_Channel1->CCR   = DMA_CCR_PL_1 | DMA_CCR_TCIE | DMA_CCR_TEIE |
+                           (rx ? DMA_CCR_MINC : 0);
+
+    // TX: memory -> peripheral, 8-bit
+    DMA2_Channel2->CMAR  = tx ? (uint32_t)tx : (uint32_t)&DUMMY;
+    DMA2_Channel2->CNDTR = len;
+    DMA2_Channel2->CCR   = DMA_CCR_DIR | (tx ? DMA_CCR_MINC : 0);
+
+    // RX side armed before TX so no byte is missed
+    SPI3->CR2 |= SPI_CR2_RXDMAEN;
+    DMA2_Channel1->CCR |= DMA_CCR_EN;
+    DMA2_Channel2->CCR |= DMA_CCR_EN;
+    SPI3->CR2 |= SPI_CR2_TXDMAEN;
+}
+
+int spi3_dma_busy(void) {
+    return dma_busy;
+}
+
+// Block until the running transfer completes; 0 = ok, 1 = DMA error
+int spi3_dma_wait(void) {
+    while (dma_busy);
+    return dma_error;
+}
+
+void DMA2_Channel1_IRQHandler(void) {
+
+    uint32_t isr = DMA2->ISR;
+    DMA2->IFCR = DMA_IFCR_CGIF1 | DMA_IFCR_CGIF2;
+
+    if (isr & (DMA_ISR_TCIF1 | DMA_ISR_TEIF1)) {
+        DMA2_Channel1->CCR &= ~DMA_CCR_EN;
+        DMA2_Channel2->CCR &= ~DMA_CCR_EN;
+        SPI3->CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+
+        if (isr & DMA_ISR_TEIF1)
+            dma_error = 1;
+        dma_busy = 0;
+
+        if (dma_done_cb)
+            dma_done_cb();
+    }
+}
+
 //--------------------------------------------------
 // SD wrappers
 //--------------------------------------------------
@@ -22,6 +22,17 @@ typedef enum {
 void initSPI3(SPI_BaudRate br, int cpol, int cpha);
 uint8_t spi3_transfer(uint8_t byte);
 
+// SPI3 hardware CRC16 around a data phase
+void spi3_crc_begin(void);
+uint8_t spi3_transfer_crc_last(uint8_t byte);
+int spi3_crc_end(void);
+
+// SPI3 DMA block transfers (DMA2 CH1/CH2)
+void initSPI3_DMA(void);
+void spi3_dma_start(uint8_t* rx, const uint8_t* tx, uint16_t len, void (*done)(void));
+int spi3_dma_busy(void);
+int spi3_dma_wait(void);
+
 // SD helper wrappers
 void SD_Select(void);
 void SD_Deselect(void);
@@ -0,0 +1,169 @@
+#include "audio_ring.h"
+
+#if AUDIO_RING_SECTORS
+
+// Each sector holds up to 512 bytes from its start: the producer's reads
+// after the WAV header are sector aligned, only the first and the last
+// read of a track come up short
+static BYTE ring[AUDIO_RING_SECTORS][512];
+static uint16_t ring_len[AUDIO_RING_SECTORS];
+
+static UINT head = 0;       // oldest filled sector
+static UINT tail = 0;       // next free sector
+static UINT filled = 0;     // sectors between them
+static UINT head_sent = 0;  // bytes of ring[head] already consumed
+static UINT level = 0;      // unsent bytes
+static UINT in_flight = 0;  // handed to the sink, consumed once it is ready again
+
+// Full once since the reset, and empty since the last underrun counted
+static uint8_t primed = 0;
+static uint8_t dry = 0;
+
+static AudioRingStats stats = { AUDIO_RING_SECTORS * 512, 0, 0, 0 };
+
+// -----------------------------------------------------------------------------
+// Drop everything queued (track skip); the statistics are kept
+// -----------------------------------------------------------------------------
+void audio_ring_reset(void) {
+    head = tail = filled = 0;
+    head_sent = 0;
+    level = 0;
+    in_flight = 0;
+    primed = 0;
+    dry = 0;
+}
+
+// -----------------------------------------------------------------------------
+// Producer
+// -----------------------------------------------------------------------------
+BYTE* audio_ring_space(UINT* len) {
+    UINT n = AUDIO_RING_SECTORS - tail;
+
+    if (filled == AUDIO_RING_SECTORS) {
+        *len = 0;
+        return 0;
+    }
+
+    if (n > AUDIO_RING_SECTORS - filled)
+        n = AUDIO_RING_SECTORS - filled;
+    if (n > AUDIO_RING_BURST)
+        n = AUDIO_RING_BURST;
+
+    *len = n * 512;
+    return ring[tail];
+}
+
+void audio_ring_commit(UINT len) {
+    // End of the stream: the ring draining out is no dip
+    if (len == 0) {
+        primed = 0;
+        return;
+    }
+
+    while (len) {
+        UINT n = (len < 512) ? len : 512;
+        ring_len[tail] = (uint16_t)n;
+        tail = (tail + 1) % AUDIO_RING_SECTORS;
+        filled++;
+        level += n;
+        len -= n;
+    }
+
+    stats.reads++;
+    if (level > stats.high_water)
+        stats.high_water = level;
+    if (filled == AUDIO_RING_SECTORS)
+        primed = 1;
+    dry = 0;
+}
+
+// -----------------------------------------------------------------------------
+// Consumer
+// -----------------------------------------------------------------------------
+const BYTE* audio_ring_data(UINT* len) {
+    if (filled == 0) {
+        *len = 0;
+        return 0;
+    }
+
+    *len = ring_len[head] - head_sent;
+    return ring[head] + head_sent;
+}
+
+void audio_ring_consume(UINT len) {
+    head_sent += len;
+    level -= len;
+
+    if (head_sent >= ring_len[head]) {
+        head_sent = 0;
+        head = (head + 1) % AUDIO_RING_SECTORS;
+        filled--;
+    }
+
+    if (primed && level < stats.low_water)
+        stats.low_water = level;
+}
+
+// -----------------------------------------------------------------------------
+// Hand the sink (fpga_stream) as much as it takes, up to limit. A DMA
+// sink still reads what it was given after returning, so those bytes stay
+// in the ring until the sink reports ready again. Running empty while it
+// has room is an underrun, counted once per dry spell.
+// -----------------------------------------------------------------------------
+UINT audio_ring_drain(UINT (*sink)(const BYTE*, UINT), UINT limit) {
+    const BYTE* p;
+    UINT len, sent = 0;
+
+    for (;;) {
+        if (!sink(0, 0))
+            return sent;
+
+        if (in_flight) {
+            audio_ring_consume(in_flight);
+            in_flight = 0;
+        }
+        if (sent == limit)
+            return sent;
+
+        p = audio_ring_data(&len);
+        if (p == 0)
+            break;
+        if (len > limit - sent)
+            len = limit - sent;
+
+        in_flight = sink(p, len);
+        if (in_flight == 0)
+            return sent;
+        sent += in_flight;
+    }
+
+    if (primed && !dry) {
+        stats.underruns++;
+        dry = 1;
+    }
+    return sent;
+}
+
+// -----------------------------------------------------------------------------
+// Statistics
+// -----------------------------------------------------------------------------
+UINT audio_ring_level(void) {
+    return level;
+}
+
+UINT audio_ring_unsent(void) {
+    return level - in_flight;
+}
+
+const AudioRingStats* audio_ring_stats(void) {
+    return &stats;
+}
+
+void audio_ring_reset_stats(void) {
+    stats.low_water = AUDIO_RING_SECTORS * 512;
+    stats.high_water = level;
+    stats.underruns = 0;
+    stats.reads = 0;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef AUDIO_RING_H
+#define AUDIO_RING_H
+
+#include "main.h"
+
+// Largest producer read, in sectors (one multi-block command)
+#ifndef AUDIO_RING_BURST
+#define AUDIO_RING_BURST 4
+#endif
+
+// Fill levels in bytes. The low-water mark only counts once the ring has
+// been full since the last audio_ring_reset(), so priming is not a dip.
+typedef struct {
+    uint32_t low_water;
+    uint32_t high_water;
+    uint32_t underruns;     // ran empty while the sink could take data
+    uint32_t reads;         // producer commits
+} AudioRingStats;
+
+void audio_ring_reset(void);
+
+// Producer: free space at the write end (whole sectors, at most
+// AUDIO_RING_BURST, never across the wrap), 0 when full. Committing 0
+// bytes ends the stream: the statistics ignore the ring running out.
+BYTE* audio_ring_space(UINT* len);
+void audio_ring_commit(UINT len);
+
+// Consumer: unsent bytes of the oldest sector, 0 when empty
+const BYTE* audio_ring_data(UINT* len);
+void audio_ring_consume(UINT len);
+
+// Hand the sink at most limit bytes (AUDIO_RING_ALL: no limit); returns
+// how many it took
+#define AUDIO_RING_ALL ((UINT)-1)
+UINT audio_ring_drain(UINT (*sink)(const BYTE*, UINT), UINT limit);
+
+// Bytes queued (level), and those of them not handed to the sink yet
+UINT audio_ring_level(void);
+UINT audio_ring_unsent(void);
+const AudioRingStats* audio_ring_stats(void);
+void audio_ring_reset_stats(void);
+
+#endif
@@ -1,8 +1,73 @@
 #include "diskio.h"
 #include "SD_lowlevel.h"
+#include <string.h>
 
 #define DEV_SD 0
 
+///////////////////////////////////////////////////////////////////////////////
+// Sector cache
+//
+// Small write-through LRU (read-only in PLAYBACK_ONLY) in front of
+// SD_lowlevel for the FAT and directory sectors FatFs keeps re-reading
+// (track open, directory scans, cluster-chain walks). Only single-sector
+// reads are cached; multi-sector runs and, while a track is streaming, any
+// sector at or above the bypass limit (the data area) go straight to the
+// card.
+///////////////////////////////////////////////////////////////////////////////
+#if DISKIO_CACHE_SECTORS
+
+typedef struct {
+    LBA_t sector;
+    DWORD used;         // LRU stamp, 0 = empty line
+    BYTE  data[512];
+} CacheLine;
+
+static CacheLine cache[DISKIO_CACHE_SECTORS];
+static DWORD cache_clock = 0;
+static LBA_t cache_limit = 0;   // reads >= limit bypass (0 = cache everything)
+static DISK_CACHE_STATS cache_stats;
+
+static CacheLine* cache_find(LBA_t sector) {
+    for (int i = 0; i < DISKIO_CACHE_SECTORS; i++) {
+        if (cache[i].used && cache[i].sector == sector)
+            return &cache[i];
+    }
+    return 0;
+}
+
+static void cache_fill(LBA_t sector, const BYTE* data) {
+    CacheLine* victim = &cache[0];
+
+    for (int i = 1; i < DISKIO_CACHE_SECTORS && victim->used; i++) {
+        if (cache[i].used < victim->used)
+            victim = &cache[i];
+    }
+
+    victim->sector = sector;
+    victim->used = ++cache_clock;
+    memcpy(victim->data, data, 512);
+}
+
+static void cache_invalidate(void) {
+    for (int i = 0; i < DISKIO_CACHE_SECTORS; i++)
+        cache[i].used = 0;
+}
+
+void disk_cache_bypass_from(LBA_t sector) {
+    cache_limit = sector;
+}
+
+const DISK_CACHE_STATS* disk_cache_stats(void) {
+    return &cache_stats;
+}
+
+#else
+
+void disk_cache_bypass_from(LBA_t sector) { (void)sector; }
+const DISK_CACHE_STATS* disk_cache_stats(void) { return 0; }
+
+#endif
+
 DSTATUS disk_status(BYTE pdrv) {
     return (pdrv == DEV_SD) ? 0 : STA_NOINIT;
 }
@@ -10,6 +75,10 @@ DSTATUS disk_status(BYTE pdrv) {
 DSTATUS disk_initialize(BYTE pdrv) {
     if (pdrv != DEV_SD)
         return STA_NOINIT;
+
+#if DISKIO_CACHE_SECTORS
+    cache_invalidate();
+#endif
     return (SD_Init() == SD_OK) ? 0 : STA_NOINIT;
 }
 
@@ -17,41 +86,99 @@ DRESULT disk_read(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count) {
     if (pdrv != DEV_SD)
         return RES_PARERR;
 
-    while (count--) {
-        if (SD_ReadBlock(sector++, buff) != SD_OK)
+    // Runs of sectors (cluster-sized f_read) go out as one CMD18
+    if (count > 1)
+        return (SD_ReadMultiBlock(sector, buff, count) == SD_OK) ? RES_OK : RES_ERROR;
+
+#if DISKIO_CACHE_SECTORS
+    if (cache_limit == 0 || sector < cache_limit) {
+        CacheLine* line = cache_find(sector);
+
+        if (line) {
+            cache_stats.hits++;
+            line->used = ++cache_clock;
+            memcpy(buff, line->data, 512);
+            return RES_OK;
+        }
+
+        cache_stats.misses++;
+        if (SD_ReadBlock(sector, buff) != SD_OK)
             return RES_ERROR;
-        buff += 512;
+
+        cache_fill(sector, buff);
+        return RES_OK;
     }
-    return RES_OK;
+    cache_stats.bypassed++;
+#endif
+
+    return (SD_ReadBlock(sector, buff) == SD_OK) ? RES_OK : RES_ERROR;
 }
 
+#if !FF_FS_READONLY
 DRESULT disk_write(BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count) {
     if (pdrv != DEV_SD)
         return RES_PARERR;
 
-    while (count--) {
-        if (SD_WriteBlock(sector++, buff) != SD_OK)
-            return RES_ERROR;
-        buff += 512;
+    // Runs go out as one ACMD23 + CMD25 transaction
+    uint8_t r = (count > 1) ? SD_WriteMultiBlock(sector, buff, count)
+                            : SD_WriteBlock(sector, buff);
+
+#if DISKIO_CACHE_SECTORS
+    if (r != SD_OK) {
+        // Unknown how much of the run landed
+        cache_invalidate();
+        return RES_ERROR;
     }
-    return RES_OK;
+
+    // Write-through: keep any cached copy in step with the card
+    for (UINT i = 0; i < count; i++) {
+        CacheLine* line = cache_find(sector + i);
+        if (line)
+            memcpy(line->data, buff + 512 * i, 512);
+    }
+#endif
+
+    return (r == SD_OK) ? RES_OK : RES_ERROR;
 }
+#endif
 
 DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff) {
     if (pdrv != DEV_SD)
         return RES_PARERR;
 
     switch (cmd) {
+#if !FF_FS_READONLY
         case CTRL_SYNC:
-            return RES_OK;
+            return (SD_Sync() == SD_OK) ? RES_OK : RES_ERROR;
+#endif
         case GET_SECTOR_SIZE:
             *(WORD*)buff = 512;
             return RES_OK;
         case GET_BLOCK_SIZE:
-            *(DWORD*)buff = 1;
+            *(DWORD*)buff = SD_GetEraseBlock();
             return RES_OK;
         case GET_SECTOR_COUNT:
-            *(DWORD*)buff = 32768000U; // for 16GB card
+            *(DWORD*)buff = SD_GetSectorCount();
+            return (*(DWORD*)buff != 0) ? RES_OK : RES_ERROR;
+        case MMC_GET_TYPE:
+            *(BYTE*)buff = SD_GetCardType();
+            return RES_OK;
+        case MMC_GET_CSD:
+            memcpy(buff, SD_GetCardInfo()->csd, 16);
+            return RES_OK;
+        case MMC_GET_CID:
+            memcpy(buff, SD_GetCardInfo()->cid, 16);
+            return RES_OK;
+        case MMC_GET_OCR:
+            memcpy(buff, SD_GetCardInfo()->ocr, 4);
+            return RES_OK;
+        case MMC_GET_SDSTAT:
+            if (SD_GetCardType() == CARD_SD1)
+                return RES_PARERR;
+            memcpy(buff, SD_GetCardInfo()->sdstat, 64);
+            return RES_OK;
+        case SD_GET_CLOCK:
+            *(DWORD*)buff = SD_GetClockHz();
             return RES_OK;
     }
     return RES_PARERR;
@@ -34,6 +34,27 @@ DRESULT disk_write (BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 
 
+/*---------------------------------------*/
+/* Sector cache (diskio.c)               */
+
+#ifndef DISKIO_CACHE_SECTORS
+#ifdef RAM_LEAN
+#define DISKIO_CACHE_SECTORS	2	/* RAM_LEAN: FAT + directory sector of the track being opened */
+#else
+#define DISKIO_CACHE_SECTORS	4	/* Cached 512-byte sectors (0: no cache) */
+#endif
+#endif
+
+typedef struct {
+	DWORD hits;			/* Single-sector reads served from RAM */
+	DWORD misses;		/* Single-sector reads that went to the card */
+	DWORD bypassed;		/* Single-sector reads skipped by the bypass limit */
+} DISK_CACHE_STATS;
+
+void disk_cache_bypass_from (LBA_t sector);		/* Reads at or above sector skip the cache (0: cache all) */
+const DISK_CACHE_STATS* disk_cache_stats (void);
+
+
 /* Disk Status Bits (DSTATUS) */
 
 #define STA_NOINIT		0x01	/* Drive not initialized */
@@ -66,6 +87,9 @@ DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 #define ISDIO_WRITE			56	/* Write data to SD iSDIO register */
 #define ISDIO_MRITE			57	/* Masked write data to SD iSDIO register */
 
+/* Project specific ioctl command (SD_lowlevel) */
+#define SD_GET_CLOCK		60	/* Get negotiated SPI clock to the card in Hz (DWORD) */
+
 /* ATA/CF specific ioctl command (Not used by FatFs) */
 #define ATA_GET_REV			20	/* Get F/W revision */
 #define ATA_GET_MODEL		21	/* Get model name */
@@ -8,11 +8,16 @@
 / Function Configurations
 /---------------------------------------------------------------------------*/
 
+#ifdef PLAYBACK_ONLY
+#define FF_FS_READONLY	1
+#else
 #define FF_FS_READONLY	0
+#endif
 /* This option switches read-only configuration. (0:Read/Write or 1:Read-only)
 /  Read-only configuration removes writing API functions, f_write(), f_sync(),
 /  f_unlink(), f_mkdir(), f_chmod(), f_rename(), f_truncate(), f_getfree()
-/  and optional writing functions as well. */
+/  and optional writing functions as well.
+/  The PLAYBACK_ONLY profile uses it; the track index is then only read. */
 
 
 #define FF_FS_MINIMIZE	0
@@ -22,7 +27,9 @@
 /   1: f_stat(), f_getfree(), f_unlink(), f_mkdir(), f_truncate() and f_rename()
 /      are removed.
 /   2: f_opendir(), f_readdir() and f_closedir() are removed in addition to 1.
-/   3: f_lseek() function is removed in addition to 2. */
+/   3: f_lseek() function is removed in addition to 2.
+/  Stays 0 in every profile: wav.c needs f_stat() (library directory stamp),
+/  the directory functions (scan) and f_lseek(). */
 
 
 #define FF_USE_FIND		0
@@ -30,11 +37,15 @@
 /  f_findnext(). (0:Disable, 1:Enable 2:Enable with matching altname[] too) */
 
 
+#if defined(HOST_BUILD) && !defined(PLAYBACK_ONLY)
+#define FF_USE_MKFS		1	/* host/ bench formats its own test images */
+#else
 #define FF_USE_MKFS		0
+#endif
 /* This option switches f_mkfs(). (0:Disable or 1:Enable) */
 
 
-#define FF_USE_FASTSEEK	0
+#define FF_USE_FASTSEEK	1
 /* This option switches fast seek feature. (0:Disable or 1:Enable) */
 
 
@@ -47,12 +58,12 @@
 /  (0:Disable or 1:Enable) Also FF_FS_READONLY needs to be 0 to enable this option. */
 
 
-#define FF_USE_LABEL	0
+#define FF_USE_LABEL	1
 /* This option switches volume label API functions, f_getlabel() and f_setlabel().
 /  (0:Disable or 1:Enable) */
 
 
-#define FF_USE_FORWARD	0
+#define FF_USE_FORWARD	1
 /* This option switches f_forward(). (0:Disable or 1:Enable) */
 
 
@@ -84,7 +95,7 @@
 / Locale and Namespace Configurations
 /---------------------------------------------------------------------------*/
 
-#define FF_CODE_PAGE	932
+#define FF_CODE_PAGE	437
 /* This option specifies the OEM code page to be used on the target system.
 /  Incorrect code page setting can cause a file open failure.
 /
@@ -113,7 +124,7 @@
 */
 
 
-#define FF_USE_LFN		0
+#define FF_USE_LFN		1
 #define FF_MAX_LFN		255
 /* The FF_USE_LFN switches the support for LFN (long file name).
 /
@@ -217,7 +228,9 @@
 
 #define FF_LBA64		0
 /* This option switches support for 64-bit LBA. (0:Disable or 1:Enable)
-/  To enable the 64-bit LBA, also exFAT needs to be enabled. (FF_FS_EXFAT == 1) */
+/  To enable the 64-bit LBA, also exFAT needs to be enabled. (FF_FS_EXFAT == 1)
+/  Not needed: SDXC ends at 2 TB, which 32-bit LBAs (and SD_lowlevel's 32-bit
+/  sector numbers) cover. */
 
 
 #define FF_MIN_GPT		0x10000000
@@ -236,17 +249,24 @@
 / System Configurations
 /---------------------------------------------------------------------------*/
 
+#ifdef RAM_LEAN
+#define FF_FS_TINY		1
+#else
 #define FF_FS_TINY		0
+#endif
 /* This option switches tiny buffer configuration. (0:Normal or 1:Tiny)
 /  At the tiny configuration, size of file object (FIL) is reduced FF_MAX_SS bytes.
 /  Instead of private sector buffer eliminated from the file object, common sector
-/  buffer in the filesystem object (FATFS) is used for the file data transfer. */
+/  buffer in the filesystem object (FATFS) is used for the file data transfer.
+/  The RAM_LEAN profile uses it: f_forward() then streams audio out of FATFS.win,
+/  which holds directory and FAT sectors only while a track is being opened. */
 
 
-#define FF_FS_EXFAT		0
+#define FF_FS_EXFAT		1
 /* This option switches support for exFAT filesystem. (0:Disable or 1:Enable)
 /  To enable exFAT, also LFN needs to be enabled. (FF_USE_LFN >= 1)
-/  Note that enabling exFAT discards ANSI C (C89) compatibility. */
+/  Note that enabling exFAT discards ANSI C (C89) compatibility.
+/  SDXC cards (64 GB and up) ship exFAT-formatted. FSIZE_t becomes 64-bit. */
 
 
 #define FF_FS_NORTC		0
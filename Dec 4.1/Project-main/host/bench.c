@@ -0,0 +1,865 @@
+// bench.c
+// Host benchmark for the storage stack: runs the real ff.c / diskio.c /
+// wav.c against sd_image.c and reports throughput, modelled card time and
+// the per-read latency seen by the player loop.
+//
+//   ./bench --mkfs sd.img --files 4 --size 1048576   build a test image
+//   ./bench --mkfs frag.img --interleave 32768        ... with fragmented tracks
+//   ./bench --mkfs lib.img --albums 4 --playlist      ... in folders, with an M3U
+//   ./bench --mkfs tags.img --chunks                  ... with LIST/fact/extensible headers
+//   ./bench sd.img --latency-us 300 --spike-every 200 --spike-us 20000
+//   ./bench sd.img --ring --spike-every 50 --spike-us 30000   ... through the audio ring
+//   ./bench --mkfs s24.img --format "s24 stereo"     tracks to convert (--verify checks them)
+//   ./bench --mkfs mix.img --files 8 --format mixed   ... each in the next format
+//   ./bench mix.img --chain --verify                  every track through one ring
+//   ./bench --convert                                 conversion cost per sample format
+//
+// Images may also be copied straight off a real card (dd if=/dev/sdX).
+
+#include "main.h"
+#include "wav.h"
+#include "sd_image.h"
+#include "audio_ring.h"
+#include "spi_fpga.h"
+#include "pcm_convert.h"
+#include "track_switch.h"
+#include <stdlib.h>
+#include <time.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Globals normally defined in main.c (used by wav.c)
+///////////////////////////////////////////////////////////////////////////////
+FATFS FatFs;
+FIL file;
+FRESULT fres;
+BYTE audio_buffer[512];
+UINT bytesRead;
+
+// The sample clock track_switch.c sets: its last rate, and how often
+static uint32_t clockRate, clockSwitches;
+
+void TIM2_SetSampleRate(uint32_t hz) {
+    clockRate = hz;
+    clockSwitches++;
+}
+
+// Tracks written by --mkfs; long names exercise LFN. With --albums N,
+// track t is in ALBUM_DIR t % N (pass the same --albums when running).
+#define BENCH_MAX_FILES 64
+#define TRACK_NAME      "Track %02u - bench tone.wav"
+#define ALBUM_DIR       "Music/Album %u"
+
+static uint32_t albums = 0;
+static uint32_t clusterSize = 32768;    // --mkfs; 4096 or less gives FAT32
+static BYTE fsFormat = FM_FAT | FM_FAT32;   // --exfat: FM_EXFAT
+static int chunks = 0;                      // --chunks: extra RIFF chunks
+static int sampleFormat = 2;                // --format: pcm_formats[] entry,
+                                            // -1 (mixed): track t in entry t
+
+// The player consumes 512 bytes per refill at 48 kHz 16-bit mono
+#define SAMPLE_RATE     48000
+#define REFILL_US       (512.0 * 1e6 / (SAMPLE_RATE * 2))
+
+///////////////////////////////////////////////////////////////////////////////
+// Helpers
+///////////////////////////////////////////////////////////////////////////////
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Deterministic test signal so --verify can check every byte
+static uint8_t pattern(uint32_t track, uint32_t offset) {
+    return (uint8_t)((offset * 31u) ^ (offset >> 9) ^ (track * 0x5Du));
+}
+
+#if !FF_FS_READONLY
+static void put32(BYTE* p, uint32_t v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void put16(BYTE* p, uint16_t v) {
+    p[0] = v; p[1] = v >> 8;
+}
+
+// Header before the audio: the plain 44 bytes, or with --chunks what tag
+// editors leave: an extensible fmt, a fact chunk and an odd-sized LIST
+// chunk that pushes the data chunk past the parser's first read, plus a
+// chunk after the audio that must not be played. Returns its length.
+#define LIST_BYTES      301
+#define TRAILER_BYTES   32
+
+static UINT wav_header(BYTE* h, uint32_t track, uint32_t dataSize) {
+    // KSDATAFORMAT_SUBTYPE_* after the format tag
+    static const BYTE guid_tail[14] = { 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80,
+                                        0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 };
+    const WAV_Format* fmt = &pcm_formats[(sampleFormat < 0) ? track % PCM_FORMATS : (uint32_t)sampleFormat];
+    UINT fmtLen = chunks ? 40 : 16;
+    BYTE* f = h + 20;
+    UINT n;
+
+    memcpy(h, "RIFF", 4);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put32(h + 16, fmtLen);
+    put16(f, chunks ? WAV_FORMAT_EXTENSIBLE : fmt->format_tag);
+    put16(f + 2, fmt->channels);
+    put32(f + 4, SAMPLE_RATE);
+    put32(f + 8, SAMPLE_RATE * fmt->block_align);
+    put16(f + 12, fmt->block_align);
+    put16(f + 14, fmt->bits);
+    n = 20 + fmtLen;
+
+    if (chunks) {
+        put16(f + 16, 22);
+        put16(f + 18, fmt->bits);       // valid bits
+        put32(f + 20, (fmt->channels == 2) ? 3 : 4);    // front L+R, or center
+        put16(f + 24, fmt->format_tag);
+        memcpy(f + 26, guid_tail, sizeof(guid_tail));
+
+        memcpy(h + n, "fact", 4);
+        put32(h + n + 4, 4);
+        put32(h + n + 8, dataSize / fmt->block_align);
+        n += 12;
+
+        memcpy(h + n, "LIST", 4);
+        put32(h + n + 4, LIST_BYTES);
+        memset(h + n + 8, 'L', LIST_BYTES + 1);
+        n += 8 + LIST_BYTES + 1;
+    }
+
+    memcpy(h + n, "data", 4);
+    put32(h + n + 4, dataSize);
+    n += 8;
+
+    put32(h + 4, n - 8 + dataSize + (chunks ? (dataSize & 1) + 8 + TRAILER_BYTES : 0));
+    return n;
+}
+
+// With --chunks: the pad byte of an odd data chunk, then a tag chunk of
+// 0xEE bytes the verify pass would catch
+static void wav_trailer(FIL* fp, uint32_t dataSize) {
+    BYTE t[1 + 8 + TRAILER_BYTES];
+    UINT skip = !(dataSize & 1), bw;
+
+    if (!chunks)
+        return;
+    t[0] = 0;
+    memcpy(t + 1, "id3 ", 4);
+    put32(t + 5, TRAILER_BYTES);
+    memset(t + 9, 0xEE, TRAILER_BYTES);
+    f_write(fp, t + skip, sizeof(t) - skip, &bw);
+}
+#endif
+
+static void track_name(char* name, size_t len, uint32_t t) {
+    if (albums)
+        snprintf(name, len, ALBUM_DIR "/" TRACK_NAME, (unsigned)(t % albums), (unsigned)t);
+    else
+        snprintf(name, len, TRACK_NAME, (unsigned)t);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Image creation (not in a PLAYBACK_ONLY build: make images with the
+// default one)
+///////////////////////////////////////////////////////////////////////////////
+#if !FF_FS_READONLY
+// Playlist of every track, last first: a comment, CRLF line ends and
+// DOS separators, as a desktop player writes it
+static int make_playlist(uint32_t files) {
+    char line[96];
+    UINT bw;
+
+    if (f_open(&file, WAV_PLAYLIST, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+        return 1;
+
+    f_write(&file, "#EXTM3U\r\n", 9, &bw);
+    for (uint32_t t = files; t-- > 0;) {
+        track_name(line, sizeof(line), t);
+        for (char* c = line; *c; c++)
+            if (*c == '/')
+                *c = '\\';
+        strcat(line, "\r\n");
+        f_write(&file, line, strlen(line), &bw);
+    }
+    return (f_close(&file) == FR_OK) ? 0 : 1;
+}
+
+// Tracks are written round-robin in chunks of `interleave` bytes
+// (0 = one after another), so a small interleave fragments every track
+static int make_image(const char* path, uint32_t files, uint32_t size, uint32_t interleave, int playlist) {
+    static BYTE work[FF_MAX_SS];
+    static FIL out[BENCH_MAX_FILES];
+    MKFS_PARM opt = { fsFormat, 0, 0, 0, clusterSize };
+
+    uint32_t sectors = (uint32_t)(((uint64_t)files * (size + 65536) + (64u << 20)) / 512);
+    if (sd_image_create(path, sectors) != 0) {
+        perror(path);
+        return 1;
+    }
+
+    if (f_mkfs("", &opt, work, sizeof(work)) != FR_OK || f_mount(&FatFs, "", 1) != FR_OK) {
+        fprintf(stderr, "mkfs failed\n");
+        return 1;
+    }
+
+    if (interleave == 0)
+        interleave = size;
+
+    if (albums) {
+        f_mkdir("Music");
+        for (uint32_t a = 0; a < albums; a++) {
+            char dir[32];
+            snprintf(dir, sizeof(dir), ALBUM_DIR, (unsigned)a);
+            if (f_mkdir(dir) != FR_OK)
+                return 1;
+        }
+    }
+    if (playlist && make_playlist(files) != 0)
+        return 1;
+
+    for (uint32_t t = 0; t < files; t++) {
+        char name[64];
+        UINT bw;
+
+        track_name(name, sizeof(name), t);
+        if (f_open(&out[t], name, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+            return 1;
+
+        f_write(&out[t], audio_buffer, wav_header(audio_buffer, t, size), &bw);
+
+        // Sequential layout: write the whole track before opening the next
+        if (interleave < size)
+            continue;
+        for (uint32_t off = 0; off < size; off += sizeof(audio_buffer)) {
+            UINT n = (size - off < sizeof(audio_buffer)) ? size - off : sizeof(audio_buffer);
+            for (UINT i = 0; i < n; i++)
+                audio_buffer[i] = pattern(t, off + i);
+            if (f_write(&out[t], audio_buffer, n, &bw) != FR_OK || bw != n)
+                return 1;
+        }
+        wav_trailer(&out[t], size);
+        f_close(&out[t]);
+    }
+
+    for (uint32_t base = 0; interleave < size && base < size; base += interleave) {
+        for (uint32_t t = 0; t < files; t++) {
+            for (uint32_t off = base; off < base + interleave && off < size; off += sizeof(audio_buffer)) {
+                UINT n = (size - off < sizeof(audio_buffer)) ? size - off : sizeof(audio_buffer);
+                UINT bw;
+                for (UINT i = 0; i < n; i++)
+                    audio_buffer[i] = pattern(t, off + i);
+                if (f_write(&out[t], audio_buffer, n, &bw) != FR_OK || bw != n)
+                    return 1;
+            }
+        }
+    }
+    if (interleave < size)
+        for (uint32_t t = 0; t < files; t++) {
+            wav_trailer(&out[t], size);
+            f_close(&out[t]);
+        }
+
+    f_mount(0, "", 0);
+    printf("%s: %u sectors, %u tracks of %u bytes\n", path, (unsigned)sectors, (unsigned)files, (unsigned)size);
+    return 0;
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Benchmark
+///////////////////////////////////////////////////////////////////////////////
+
+// Byte off of what reaches the link from a track in format fmt: the
+// pattern as is for 16-bit mono, else the pattern's frames through the
+// reference conversion
+static uint8_t link_byte(const WAV_Format* fmt, uint32_t track, uint32_t off) {
+    UINT size = fmt->block_align;
+    BYTE in[8];
+    int16_t s;
+
+    if (fmt->bits == 16 && size == 2)
+        return pattern(track, off);
+
+    for (UINT j = 0; j < size; j++)
+        in[j] = pattern(track, off / 2 * size + j);
+    pcm_convert_ref(fmt, in, 1, &s);
+    return (uint8_t)((off & 1) ? (uint16_t)s >> 8 : s);
+}
+
+// --chain: the tracks opened so far, in play order, with the link bytes
+// each should give (whole frames: a partial last one is dropped at the
+// switch), and the one the sink is in
+typedef struct {
+    int track;
+    WAV_Format fmt;
+    uint32_t link_len;
+} ChainTrack;
+
+static ChainTrack chainTrack[BENCH_MAX_FILES];
+static uint32_t chainOpened, chainAt;
+
+// f_forward() sink standing in for fpga_stream(): always ready, checks
+// the bytes it is handed in place. With --chain a track's bytes are
+// expected to start where the one before it ended.
+static uint32_t sink_track, sink_off, sink_bad;
+static const WAV_Format* sink_fmt;
+static int sink_verify;
+
+static UINT bench_sink(const BYTE* p, UINT n) {
+    if (n == 0)
+        return 1;
+    for (UINT i = 0; i < n; i++, sink_off++) {
+        if (chainAt + 1 < chainOpened && sink_off == chainTrack[chainAt].link_len) {
+            chainAt++;
+            sink_track = chainTrack[chainAt].track;
+            sink_fmt = &chainTrack[chainAt].fmt;
+            sink_off = 0;
+        }
+        if (sink_verify && p[i] != link_byte(sink_fmt, sink_track, sink_off))
+            sink_bad++;
+    }
+    return n;
+}
+
+// --ring: the firmware loop with the audio ring in front of a model of
+// the FPGA FIFO, which plays SAMPLE_RATE * 2 bytes per second of modelled
+// card time (plus the time the loop idles with the ring full). The FIFO
+// running dry after the first bytes of a track is an audible dropout
+// (counted once until data flows again).
+static double play_us, play_base;
+static uint64_t play_sent;
+static uint32_t dropouts;
+static int play_dry;
+
+static void play_reset(void) {
+    play_base = play_us;
+    play_sent = 0;
+    play_dry = 0;
+}
+
+static UINT play_sink(const BYTE* p, UINT n) {
+    double played = (play_us - play_base) * (SAMPLE_RATE * 2) / 1e6;
+
+    if (played > (double)play_sent) {
+        if (play_sent && !play_dry)
+            dropouts++;
+        play_dry = 1;
+        play_base += (played - (double)play_sent) * 1e6 / (SAMPLE_RATE * 2);
+        played = (double)play_sent;
+    }
+
+    UINT room = (UINT)(FPGA_FIFO_BYTES - ((double)play_sent - played)) & ~1u;
+    if (n == 0)
+        return room != 0;
+    if (n > room)
+        n = room;
+    if (n == 0)
+        return 0;
+    play_sent += n;
+    play_dry = 0;
+    return bench_sink(p, n);
+}
+
+static void print_hist(const char* title, const uint32_t* hist) {
+    printf("%s\n", title);
+    for (int b = 0; b < SD_IMAGE_HIST_BUCKETS; b++) {
+        if (!hist[b])
+            continue;
+        if (b == SD_IMAGE_HIST_BUCKETS - 1)
+            printf("  >= %6u us : %u\n", 1u << (b - 1), (unsigned)hist[b]);
+        else
+            printf("  <  %6u us : %u\n", 1u << b, (unsigned)hist[b]);
+    }
+}
+
+// Start cluster of each --mkfs track, to tell which one a record is
+static DWORD trackClust[BENCH_MAX_FILES];
+
+static uint32_t map_tracks(void) {
+    uint32_t n = 0;
+
+    for (uint32_t t = 0; t < BENCH_MAX_FILES; t++) {
+        char name[64];
+        track_name(name, sizeof(name), t);
+        trackClust[t] = 0;
+        if (f_open(&file, name, FA_READ) == FR_OK) {
+            trackClust[t] = file.obj.sclust;
+            f_close(&file);
+            n++;
+        }
+    }
+    return n;
+}
+
+static int track_of(DWORD sclust) {
+    for (int t = 0; t < BENCH_MAX_FILES; t++)
+        if (trackClust[t] == sclust)
+            return t;
+    return -1;
+}
+
+// Copy one more track onto the card, as a user would between boots
+static int add_track(uint32_t size) {
+#if FF_FS_READONLY
+    (void)size;
+    return -1;
+#else
+    uint32_t t = 0;
+    char name[64];
+    UINT bw;
+
+    for (t = 0; t < BENCH_MAX_FILES; t++) {
+        track_name(name, sizeof(name), t);
+        if (f_stat(name, 0) != FR_OK)
+            break;
+    }
+    if (t == BENCH_MAX_FILES || f_open(&file, name, FA_WRITE | FA_CREATE_NEW) != FR_OK)
+        return -1;
+
+    f_write(&file, audio_buffer, wav_header(audio_buffer, t, size), &bw);
+    for (uint32_t off = 0; off < size; off += sizeof(audio_buffer)) {
+        UINT n = (size - off < sizeof(audio_buffer)) ? size - off : sizeof(audio_buffer);
+        for (UINT i = 0; i < n; i++)
+            audio_buffer[i] = pattern(t, off + i);
+        f_write(&file, audio_buffer, n, &bw);
+    }
+    wav_trailer(&file, size);
+    return (f_close(&file) == FR_OK) ? 0 : -1;
+#endif
+}
+
+// --chain: the firmware's ring loop over every track, without a reset
+// between them: the next track is opened at the last read of the one
+// before and queues behind it, and track_switch.c moves the clock and
+// the conversion over where its bytes start. Returns the bad byte count
+// (bytes in the wrong track count too).
+static uint32_t open_chain_track(void) {
+    ChainTrack* c = &chainTrack[chainOpened];
+
+    if (open_next_wav_file() != 0 || chainOpened == BENCH_MAX_FILES)
+        return 1;
+    c->track = track_of(wav_current_track()->sclust);
+    c->fmt = *wav_format();
+    c->link_len = c->fmt.data_length / c->fmt.block_align * 2;
+    if (c->track < 0)
+        return 1;
+
+    chainOpened++;
+    track_opened(audio_ring_unsent());
+    return 0;
+}
+
+static uint32_t play_chain(DWORD tracks, int verify, uint64_t* bytes) {
+    int reading = 0, eof = 0;
+    double done_us = 0;
+    uint32_t bad;
+
+    chainOpened = chainAt = 0;
+    clockSwitches = 0;
+    audio_ring_reset();
+    play_us = sd_image_stats.card_us;
+    play_reset();
+    pcm_reset(play_sink);
+
+    if (open_chain_track() != 0)
+        return 1;
+    sink_track = chainTrack[0].track;
+    sink_fmt = &chainTrack[0].fmt;
+    sink_off = 0;
+    sink_verify = verify;
+
+    for (;;) {
+        UINT space;
+        BYTE* slot;
+
+        track_sent(audio_ring_drain(pcm_stream, track_hold()));
+
+        if (!reading && !eof && (slot = audio_ring_space(&space)) != 0) {
+            double r0 = sd_image_stats.card_us;
+            if (wav_read_start(slot, space) != 0)
+                return 1;
+            reading = 1;
+            done_us = play_us + (sd_image_stats.card_us - r0);
+        }
+        if (!reading || play_us < done_us) {
+            if (eof && audio_ring_level() == 0)
+                break;
+            play_us += 64 * 1e6 / (SAMPLE_RATE * 2);
+            if (play_us > done_us && reading)
+                play_us = done_us;
+            continue;
+        }
+
+        reading = 0;
+        if (wav_read_poll(&bytesRead) == 0 && bytesRead) {
+            audio_ring_commit(bytesRead);
+            *bytes += bytesRead;
+            continue;
+        }
+
+        // End of the track: the last one only drains out
+        audio_ring_commit(0);
+        if (chainOpened == tracks)
+            eof = 1;
+        else if (open_chain_track() != 0)
+            return 1;
+    }
+
+    // The stage still holds the last track's tail
+    while (!pcm_stream(0, 0))
+        play_us += 64 * 1e6 / (SAMPLE_RATE * 2);
+
+    bad = (sink_off == chainTrack[chainAt].link_len && chainAt + 1 == tracks) ? 0 : 1;
+    printf("chain   %u tracks through one ring, %u clock switches, ended in track %u at byte %lu of %lu\n",
+           (unsigned)tracks, (unsigned)clockSwitches, (unsigned)chainAt, (unsigned long)sink_off,
+           (unsigned long)chainTrack[chainAt].link_len);
+    chainOpened = chainAt = 0;
+    return bad + (clockSwitches != tracks);
+}
+
+static int run_bench(int verify, uint32_t seeks, int forward, int ring, int chain, uint32_t addSize) {
+    uint32_t mapped = 0;
+
+    if (f_mount(&FatFs, "", 1) == FR_OK) {
+        if (addSize && add_track(addSize) != 0)
+            fprintf(stderr, "add track failed\n");
+        mapped = map_tracks();
+        f_mount(0, "", 0);
+    }
+
+    double t0 = now_us();
+    sd_image_reset_stats();
+
+    if (f_mount(&FatFs, "", 1) != FR_OK) {
+        fprintf(stderr, "mount failed\n");
+        return 1;
+    }
+    double tMount = now_us();
+    double cMount = sd_image_stats.card_us;
+
+    // Same boot sequence as main(): playlist, else index, else scan
+    // (which rewrites the index). A playlist pass plays every track once.
+    const char* how = "index";
+    DWORD tracks;
+    if (open_playlist() == 0) {
+        how = "playlist";
+        tracks = mapped;
+    } else {
+        if (load_track_index() != 0) {
+            scan_wav_files();
+            how = "scan";
+        }
+        tracks = wav_track_count;
+    }
+    double tScan = now_us();
+    double cScan = sd_image_stats.card_us;
+    printf("ram     FATFS %u, FIL %u, track window %u, sector cache %u, audio ring %u bytes (host sizes)\n",
+           (unsigned)sizeof(FATFS), (unsigned)sizeof(FIL), (unsigned)sizeof(wav_tracks),
+           (unsigned)DISKIO_CACHE_SECTORS * 512, (unsigned)AUDIO_RING_SECTORS * 512);
+    printf("mount   %8.0f us host, %8.0f us card\n", tMount - t0, cMount);
+    printf("library %8.0f us host, %8.0f us card  (%lu tracks, %s)\n", tScan - tMount, cScan - cMount, (unsigned long)tracks, how);
+
+    uint32_t readHist[SD_IMAGE_HIST_BUCKETS] = { 0 };
+    uint32_t misses = 0, reads = 0, bad = 0;
+    uint64_t bytes = 0;
+    double worst = 0, cStream = 0, tStream = 0;
+    double cSeek = 0, worstSeek = 0;
+    uint32_t seekCount = 0;
+
+    if (chain) {
+        double s0 = now_us(), sc0 = sd_image_stats.card_us;
+        bad += play_chain(tracks, verify, &bytes);
+        tStream += now_us() - s0;
+        cStream += sd_image_stats.card_us - sc0;
+    }
+
+    for (DWORD n = 0; n < tracks && !chain; n++) {
+        double c0 = sd_image_stats.card_us;
+        double h0 = now_us();
+
+        if (open_next_wav_file() != 0) {
+            fprintf(stderr, "open track %u failed\n", (unsigned)n);
+            return 1;
+        }
+        static const char* const modes[] = { "FAT", "CLMT", "raw" };
+        int track = track_of(wav_current_track()->sclust);
+        printf("open    %8.0f us host, %8.0f us card  track %d (%s%s, %lu Hz %u ch %u bit, %lu bytes)\n",
+               now_us() - h0, sd_image_stats.card_us - c0, track, modes[wav_stream_mode()],
+               (wav_current_track()->flags & WAV_TRACK_NOFATCHAIN) ? ", NoFatChain" : "",
+               (unsigned long)wav_format()->sample_rate, wav_format()->channels, wav_format()->bits,
+               (unsigned long)wav_format()->data_length);
+        if (track < 0) {
+            fprintf(stderr, "unknown track at cluster %lu\n", (unsigned long)wav_current_track()->sclust);
+            return 1;
+        }
+
+        uint32_t off = 0;
+        double s0 = now_us(), sc0 = sd_image_stats.card_us;
+
+        sink_track = track;
+        sink_fmt = wav_format();
+        sink_off = 0;
+        sink_verify = verify;
+
+        // Each track starts from an empty ring and FIFO, as after a skip.
+        // A read completes at done_us; the FIFO keeps playing meanwhile.
+        int eof = 0, reading = 0;
+        double done_us = 0, read_us = 0;
+        audio_ring_reset();
+        play_us = sd_image_stats.card_us;
+        play_reset();
+        pcm_reset(ring ? play_sink : bench_sink);
+        pcm_set_format(wav_format());
+
+        for (;;) {
+            double r0 = sd_image_stats.card_us;
+            if (ring) {
+                audio_ring_drain(pcm_stream, AUDIO_RING_ALL);
+
+                UINT space;
+                BYTE* slot;
+                if (!reading && !eof && (slot = audio_ring_space(&space)) != 0) {
+                    if (wav_read_start(slot, space) != 0)
+                        break;
+                    reading = 1;
+                    read_us = sd_image_stats.card_us - r0;
+                    done_us = play_us + read_us;
+                }
+                if (!reading || play_us < done_us) {
+                    if (eof && audio_ring_level() == 0)
+                        break;
+                    play_us += 64 * 1e6 / (SAMPLE_RATE * 2);
+                    if (play_us > done_us && reading)
+                        play_us = done_us;
+                    continue;
+                }
+                reading = 0;
+                if (wav_read_poll(&bytesRead) != 0 || bytesRead == 0) {
+                    audio_ring_commit(0);
+                    eof = 1;
+                    continue;
+                }
+                audio_ring_commit(bytesRead);
+                r0 = sd_image_stats.card_us - read_us;
+            } else if (forward) {
+                if (wav_forward(pcm_stream, sizeof(audio_buffer), &bytesRead) != FR_OK || bytesRead == 0)
+                    break;
+            } else if (wav_read(audio_buffer, sizeof(audio_buffer), &bytesRead) != FR_OK || bytesRead == 0) {
+                break;
+            }
+
+            // Card time one refill of the player loop had to wait
+            double dt = sd_image_stats.card_us - r0;
+            int b = 0;
+            while (b < SD_IMAGE_HIST_BUCKETS - 1 && dt >= (double)(1u << b))
+                b++;
+            readHist[b]++;
+            if (dt > worst)
+                worst = dt;
+            if (dt > REFILL_US)
+                misses++;
+            reads++;
+
+            if (verify && !forward && !ring) {
+                for (UINT i = 0; i < bytesRead; i++)
+                    if (audio_buffer[i] != pattern(track, off + i))
+                        bad++;
+            }
+            off += bytesRead;
+            bytes += bytesRead;
+        }
+
+        tStream += now_us() - s0;
+        cStream += sd_image_stats.card_us - sc0;
+
+        // Scrubbing: seek anywhere in the track and fetch one refill
+        for (uint32_t k = 0; k < seeks && off > 0; k++) {
+            uint32_t pos = (uint32_t)(((uint64_t)rand() * off) / ((uint64_t)RAND_MAX + 1));
+
+            pos -= pos % wav_format()->block_align;
+            double r0 = sd_image_stats.card_us;
+
+            if (seek_wav_file(pos) != 0 ||
+                wav_read(audio_buffer, sizeof(audio_buffer), &bytesRead) != FR_OK) {
+                bad++;
+                break;
+            }
+
+            double dt = sd_image_stats.card_us - r0;
+            cSeek += dt;
+            if (dt > worstSeek)
+                worstSeek = dt;
+            seekCount++;
+
+            if (verify) {
+                for (UINT i = 0; i < bytesRead; i++)
+                    if (audio_buffer[i] != pattern(track, pos + i))
+                        bad++;
+            }
+        }
+
+        f_close(&file);
+    }
+
+    const DISK_CACHE_STATS* cs = disk_cache_stats();
+    bad += sink_bad;
+
+    printf("stream  %8.0f us host, %8.0f us card  (%llu bytes)\n", tStream, cStream, (unsigned long long)bytes);
+    if (cStream > 0)
+        printf("        %.1f KB/s at the card model, %.1fx real time\n",
+               bytes / 1024.0 / (cStream / 1e6),
+               (bytes / ((double)SAMPLE_RATE * wav_format()->block_align)) / (cStream / 1e6));
+    if (bytes)
+        printf("        %.0f ns host CPU per sector\n", tStream * 1e3 / (bytes / 512.0));
+    printf("card    %u commands, %u sectors read, %u written, %.0f us\n",
+           (unsigned)sd_image_stats.commands, (unsigned)sd_image_stats.sectors_read,
+           (unsigned)sd_image_stats.sectors_written, sd_image_stats.card_us);
+    printf("cache   %u hits, %u misses, %u bypassed\n",
+           (unsigned)cs->hits, (unsigned)cs->misses, (unsigned)cs->bypassed);
+    printf("refill  %u reads, worst %.0f us, %u over the %.0f us budget\n",
+           (unsigned)reads, worst, (unsigned)misses, REFILL_US);
+    if (ring || chain) {
+        const AudioRingStats* rs = audio_ring_stats();
+        printf("ring    %u sectors, fill %lu-%lu bytes, %lu underruns, %u FIFO dropouts\n",
+               (unsigned)AUDIO_RING_SECTORS, (unsigned long)rs->low_water, (unsigned long)rs->high_water,
+               (unsigned long)rs->underruns, (unsigned)dropouts);
+    }
+    if (seekCount)
+        printf("seek    %u seeks, %.0f us average, %.0f us worst (seek + one refill)\n",
+               (unsigned)seekCount, cSeek / seekCount, worstSeek);
+    print_hist("per-refill card time:", readHist);
+    print_hist("per-command card time:", sd_image_stats.hist);
+
+    f_mount(0, "", 0);
+
+    if (verify) {
+        printf("verify  %s (%u bad bytes)\n", bad ? "FAILED" : "ok", (unsigned)bad);
+        return bad ? 1 : 0;
+    }
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// --convert: cost of each sample-format conversion on this machine, in
+// ns per 16-bit output sample. The host build runs the reference loops;
+// a PCM_BENCH=1 firmware build prints DWT cycles for both at boot.
+///////////////////////////////////////////////////////////////////////////////
+#define CONVERT_FRAMES 2048
+
+static int run_convert_bench(void) {
+    static BYTE in[CONVERT_FRAMES * 8];
+    static int16_t out[CONVERT_FRAMES];
+
+    for (UINT i = 0; i < sizeof(in); i++)
+        in[i] = (BYTE)rand();
+
+    for (int k = 0; k < PCM_FORMATS; k++) {
+        uint64_t samples = 0;
+        double t0 = now_us(), t;
+
+        pcm_set_format(&pcm_formats[k]);
+        do {
+            for (int r = 0; r < 64; r++)
+                pcm_convert(in, CONVERT_FRAMES, out);
+            samples += 64 * CONVERT_FRAMES;
+            t = now_us() - t0;
+        } while (t < 50000);
+
+        printf("convert %-10s %6.2f ns/sample, %6.1f Msamples/s\n", pcm_format_names[k],
+               t * 1e3 / samples, samples / t);
+    }
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Main
+///////////////////////////////////////////////////////////////////////////////
+static void usage(void) {
+    fprintf(stderr,
+        "usage: bench [--mkfs] IMAGE [--files N] [--size BYTES] [--interleave BYTES]\n"
+        "             [--albums N] [--playlist] [--cluster BYTES] [--exfat] [--chunks]\n"
+        "             [--latency-us N] [--jitter-us N] [--clock-hz N]\n"
+        "             [--spike-every N] [--spike-us N] [--seeks N] [--add-track BYTES]\n"
+        "             [--forward] [--ring] [--chain] [--realtime] [--verify]\n"
+        "             [--format NAME|mixed]\n"
+        "       bench --convert\n");
+}
+
+int main(int argc, char** argv) {
+    const char* path = 0;
+    int mkfs = 0, verify = 0, forward = 0, ring = 0, chain = 0, playlist = 0, convert = 0;
+    uint32_t files = 4, size = 1u << 20, seeks = 64, interleave = 0, addSize = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        const char* v = (i + 1 < argc) ? argv[i + 1] : 0;
+
+        if (!strcmp(a, "--mkfs"))                   mkfs = 1;
+        else if (!strcmp(a, "--verify"))           verify = 1;
+        else if (!strcmp(a, "--forward"))          forward = 1;
+        else if (!strcmp(a, "--ring"))             ring = 1;
+        else if (!strcmp(a, "--chain"))            chain = 1;
+        else if (!strcmp(a, "--playlist"))         playlist = 1;
+        else if (!strcmp(a, "--realtime"))         sd_image_cfg.realtime = 1;
+        else if (!strcmp(a, "--files") && v)       files = strtoul(argv[++i], 0, 0);
+        else if (!strcmp(a, "--size") && v)        size = strtoul(argv[++i], 0, 0);
+        else if (!strcmp(a, "--albums") && v)      albums = strtoul(argv[++i], 0, 0);
+        else if (!strcmp(a, "--seeks") && v)       seeks = strtoul(argv[++i], 0, 0);
+        else if (!strcmp(a, "--interleave") && v)  interleave = strtoul(argv[++i], 0, 0);
+        else if (!strcmp(a, "--cluster") && v)     clusterSize = strtoul(argv[++i], 0, 0);
+        else if (!strcmp(a, "--exfat"))            fsFormat = FM_EXFAT;
+        else if (!strcmp(a, "--chunks"))           chunks = 1;
+        else if (!strcmp(a, "--convert"))          convert = 1;
+        else if (!strcmp(a, "--format") && v && !strcmp(v, "mixed")) {
+            sampleFormat = -1;
+            i++;
+        }
+        else if (!strcmp(a, "--format") && v) {
+            for (sampleFormat = 0; sampleFormat < PCM_FORMATS; sampleFormat++)
+                if (!strcmp(v, pcm_format_names[sampleFormat]))
+                    break;
+            if (sampleFormat == PCM_FORMATS) { usage(); return 2; }
+            i++;
+        }
+        else if (!strcmp(a, "--add-track") && v)   addSize = strtoul(argv[++i], 0, 0);
+        else if (!strcmp(a, "--latency-us") && v)  sd_image_cfg.cmd_latency_us = strtoul(argv[++i], 0, 0);
+        else if (!strcmp(a, "--jitter-us") && v)   sd_image_cfg.jitter_us = strtoul(argv[++i], 0, 0);
+        else if (!strcmp(a, "--clock-hz") && v)    sd_image_cfg.clock_hz = strtoul(argv[++i], 0, 0);
+        else if (!strcmp(a, "--spike-every") && v) sd_image_cfg.spike_every = strtoul(argv[++i], 0, 0);
+        else if (!strcmp(a, "--spike-us") && v)    sd_image_cfg.spike_us = strtoul(argv[++i], 0, 0);
+        else if (a[0] != '-' && !path)             path = a;
+        else { usage(); return 2; }
+    }
+
+    if (convert)
+        return run_convert_bench();
+
+    if (!path) {
+        usage();
+        return 2;
+    }
+
+    if (mkfs) {
+        if (files > BENCH_MAX_FILES)
+            files = BENCH_MAX_FILES;
+#if FF_FS_READONLY
+        (void)size; (void)interleave; (void)playlist;
+        fprintf(stderr, "--mkfs needs a writable build\n");
+        return 2;
+#else
+        int rc = make_image(path, files, size, interleave, playlist);
+        sd_image_close();
+        return rc;
+#endif
+    }
+
+    if (sd_image_open(path) != 0) {
+        perror(path);
+        return 1;
+    }
+
+    int rc = run_bench(verify, seeks, forward, ring, chain, addSize);
+    sd_image_close();
+    return rc;
+}
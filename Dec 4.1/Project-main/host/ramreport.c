@@ -0,0 +1,202 @@
+// ramreport.c
+// RAM report from a SEGGER linker map (Output/<config>/Exe/project2.map):
+// every RW/ZI object in SRAM by size, RAM and flash totals per module,
+// the 512-byte sector buffers and the free space left in each region.
+//
+//   ./ramreport ../Output/Release/Exe/project2.map
+//   ./ramreport release.map lean.map                compare two builds
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_OBJECTS 1024
+#define MAX_MODULES 64
+
+// STM32L432: SRAM2 (RAM1 in the map), SRAM1 (RAM2) and flash
+#define FLASH_REGION 2
+static const struct { const char* name; unsigned long start, size; } regions[] = {
+    { "RAM1",  0x10000000, 16384 },
+    { "RAM2",  0x20000000, 49152 },
+    { "FLASH", 0x08000000, 262144 },
+};
+#define REGIONS (sizeof(regions) / sizeof(regions[0]))
+
+typedef struct {
+    char name[64];
+    char module[48];
+    unsigned long addr, size;
+} Object;
+
+typedef struct {
+    char name[48];
+    unsigned long size, flash;
+} Module;
+
+typedef struct {
+    Object obj[MAX_OBJECTS];
+    int count;
+    Module mods[MAX_MODULES];
+    int nmods;
+    unsigned long used[REGIONS];
+    unsigned long total;
+} Report;
+
+static int region_of(unsigned long addr) {
+    for (unsigned r = 0; r < REGIONS; r++)
+        if (addr >= regions[r].start && addr - regions[r].start < regions[r].size)
+            return (int)r;
+    return -1;
+}
+
+// Section detail lines: "  10000000-1000022f  FatFs   560   4  Zero  ZI  main.o".
+// A long name wraps the rest of the line (or all but size and alignment)
+// onto the next one.
+static int parse_map(const char* path, Report* rep) {
+    FILE* f = fopen(path, "r");
+    char line[512], next[512];
+    int inDetail = 0;
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    memset(rep, 0, sizeof(*rep));
+
+    while (fgets(line, sizeof(line), f)) {
+        if (strstr(line, "SECTION DETAIL")) {
+            inDetail = 1;
+            continue;
+        }
+        if (strstr(line, "SYMBOL LIST"))
+            break;
+
+        unsigned long start, end;
+        char name[64];
+        int n;
+        if (!inDetail || sscanf(line, " %lx-%lx %63s%n", &start, &end, name, &n) != 3)
+            continue;
+
+        const char* rest = line + n;
+        if (strspn(rest, " \t\r\n0123456789") == strlen(rest)) {
+            if (!fgets(next, sizeof(next), f))
+                break;
+            rest = next;
+        }
+
+        // Data type column, then the module (object, or object + archive)
+        int r = region_of(start);
+        const char* type = 0;
+        if (r == FLASH_REGION) {
+            type = strstr(rest, " RX ");
+            if (!type)
+                type = strstr(rest, " RO ");
+        } else if (r >= 0) {
+            type = strstr(rest, " ZI ");
+            if (!type)
+                type = strstr(rest, " RW ");
+        }
+        if (!type)
+            continue;
+
+        char module[48];
+        const char* mod = type + 4 + strspn(type + 4, " ");
+        if (*mod == '[')
+            snprintf(module, sizeof(module), "(linker)");
+        else
+            sscanf(mod, "%47s", module);
+
+        unsigned long size = end - start + 1;
+        rep->used[r] += size;
+
+        int m;
+        for (m = 0; m < rep->nmods && strcmp(rep->mods[m].name, module); m++)
+            ;
+        if (m == rep->nmods && rep->nmods < MAX_MODULES)
+            snprintf(rep->mods[rep->nmods++].name, sizeof(rep->mods[0].name), "%s", module);
+
+        if (r == FLASH_REGION) {
+            if (m < rep->nmods)
+                rep->mods[m].flash += size;
+            continue;
+        }
+        if (m < rep->nmods)
+            rep->mods[m].size += size;
+        rep->total += size;
+
+        if (rep->count == MAX_OBJECTS)
+            continue;
+        Object* o = &rep->obj[rep->count++];
+        snprintf(o->name, sizeof(o->name), "%s", name);
+        snprintf(o->module, sizeof(o->module), "%s", module);
+        o->addr = start;
+        o->size = size;
+    }
+    fclose(f);
+    return 0;
+}
+
+static int by_size(const void* a, const void* b) {
+    const Object* x = a;
+    const Object* y = b;
+    return (x->size < y->size) - (x->size > y->size);
+}
+
+static int mod_by_size(const void* a, const void* b) {
+    const Module* x = a;
+    const Module* y = b;
+    if (x->size != y->size)
+        return (x->size < y->size) - (x->size > y->size);
+    return (x->flash < y->flash) - (x->flash > y->flash);
+}
+
+static void print_report(const char* path, Report* rep) {
+    unsigned long sectorBufs = 0;
+
+    qsort(rep->obj, rep->count, sizeof(Object), by_size);
+
+    printf("%s\n\n", path);
+    printf("  %6s  %-32s %s\n", "bytes", "object", "module");
+    for (int i = 0; i < rep->count; i++) {
+        Object* o = &rep->obj[i];
+        if (o->size >= 64)
+            printf("  %6lu  %-32s %s%s\n", o->size, o->name, o->module, o->size >= 512 ? "  *" : "");
+        if (o->size >= 512)
+            sectorBufs += o->size;
+    }
+    printf("  (objects under 64 bytes not listed; * = 512 bytes or more)\n\n");
+
+    qsort(rep->mods, rep->nmods, sizeof(Module), mod_by_size);
+    printf("  %6s  %6s  %s\n", "ram", "flash", "module");
+    for (int m = 0; m < rep->nmods; m++)
+        printf("  %6lu  %6lu  %s\n", rep->mods[m].size, rep->mods[m].flash, rep->mods[m].name);
+    printf("\n");
+
+    for (unsigned r = 0; r < REGIONS; r++)
+        printf("  %-5s %6lu used, %6lu free of %lu\n", regions[r].name, rep->used[r],
+               regions[r].size - rep->used[r], regions[r].size);
+    printf("  total %6lu bytes static RAM (stack and heap blocks included), %lu in large buffers\n\n",
+           rep->total, sectorBufs);
+}
+
+int main(int argc, char** argv) {
+    static Report rep[2];
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: ramreport MAP [MAP2]\n");
+        return 2;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (parse_map(argv[i], &rep[i - 1]) != 0)
+            return 1;
+        print_report(argv[i], &rep[i - 1]);
+    }
+
+    if (argc == 3) {
+        long d = (long)rep[1].total - (long)rep[0].total;
+        long f = (long)rep[1].used[FLASH_REGION] - (long)rep[0].used[FLASH_REGION];
+        printf("%s vs %s: %+ld bytes static RAM, %+ld bytes flash\n", argv[2], argv[1], d, f);
+    }
+    return 0;
+}
@@ -0,0 +1,218 @@
+// sd_image.c
+// Host stand-in for SD_lowlevel.c: serves the SD_lowlevel.h API from a
+// FAT image file so diskio.c, ff.c and wav.c run unmodified on Linux.
+// Each card command is charged a modelled latency instead of SPI traffic.
+
+#include "SD_lowlevel.h"
+#include "sd_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+SD_ImageConfig sd_image_cfg = { 100, 0, 20000000, 0, 0, 0 };
+SD_ImageStats sd_image_stats;
+
+static FILE* img = 0;
+static uint32_t imgSectors = 0;
+static SD_CardInfo cardInfo;
+static SD_InitStats initStats;
+
+// Async request: completed at submit, reported on the next poll
+static uint8_t reqPending = 0;
+static uint8_t reqStatus = SD_OK;
+static SD_Callback reqDone = 0;
+
+// -----------------------------------------------------------------------------
+// Image file
+// -----------------------------------------------------------------------------
+int sd_image_open(const char* path) {
+    sd_image_close();
+
+    img = fopen(path, "r+b");
+    if (!img)
+        return -1;
+
+    fseek(img, 0, SEEK_END);
+    imgSectors = (uint32_t)(ftell(img) / 512);
+    return 0;
+}
+
+int sd_image_create(const char* path, uint32_t sectors) {
+    sd_image_close();
+
+    img = fopen(path, "w+b");
+    if (!img)
+        return -1;
+
+    // Sparse: just set the size
+    if (fseek(img, (long)sectors * 512 - 1, SEEK_SET) != 0 || fputc(0, img) == EOF)
+        return -1;
+    fflush(img);
+
+    imgSectors = sectors;
+    return 0;
+}
+
+void sd_image_close(void) {
+    if (img)
+        fclose(img);
+    img = 0;
+    imgSectors = 0;
+}
+
+void sd_image_reset_stats(void) {
+    memset(&sd_image_stats, 0, sizeof(sd_image_stats));
+}
+
+// -----------------------------------------------------------------------------
+// Card model
+// -----------------------------------------------------------------------------
+static void charge(uint32_t sectors) {
+    double us = sd_image_cfg.cmd_latency_us;
+
+    if (sd_image_cfg.jitter_us)
+        us += (double)(rand() % (sd_image_cfg.jitter_us + 1));
+
+    sd_image_stats.commands++;
+    if (sd_image_cfg.spike_every && sd_image_stats.commands % sd_image_cfg.spike_every == 0)
+        us += sd_image_cfg.spike_us;
+
+    // Token + payload + CRC per block
+    if (sd_image_cfg.clock_hz)
+        us += (double)sectors * (512 + 3) * 8 * 1e6 / sd_image_cfg.clock_hz;
+
+    sd_image_stats.card_us += us;
+
+    int b = 0;
+    while (b < SD_IMAGE_HIST_BUCKETS - 1 && us >= (double)(1u << b))
+        b++;
+    sd_image_stats.hist[b]++;
+
+    if (sd_image_cfg.realtime) {
+        uint64_t ns = (uint64_t)(us * 1000);
+        struct timespec ts = { (time_t)(ns / 1000000000u), (long)(ns % 1000000000u) };
+        nanosleep(&ts, 0);
+    }
+}
+
+static uint8_t xfer(uint32_t sector, uint8_t* rd, const uint8_t* wr, uint32_t count) {
+    if (!img || sector + count > imgSectors)
+        return SD_ERROR;
+
+    charge(count);
+
+    if (fseek(img, (long)sector * 512, SEEK_SET) != 0)
+        return SD_ERROR;
+
+    if (rd) {
+        sd_image_stats.sectors_read += count;
+        return (fread(rd, 512, count, img) == count) ? SD_OK : SD_ERROR;
+    }
+
+    sd_image_stats.sectors_written += count;
+    return (fwrite(wr, 512, count, img) == count) ? SD_OK : SD_ERROR;
+}
+
+// -----------------------------------------------------------------------------
+// SD_lowlevel.h API
+// -----------------------------------------------------------------------------
+uint8_t SD_Init(void) {
+    memset(&cardInfo, 0, sizeof(cardInfo));
+    cardInfo.type = CARD_SDHC;
+    reqPending = 0;
+
+    if (!img)
+        return SD_ERROR;
+
+    charge(0);
+    initStats.failed = SD_PHASES;
+    initStats.init_clock_hz = SD_INIT_CLOCK_HZ;
+    return SD_OK;
+}
+
+uint8_t SD_ReadBlock(uint32_t sector, uint8_t* buf) {
+    return xfer(sector, buf, 0, 1);
+}
+
+uint8_t SD_ReadMultiBlock(uint32_t sector, uint8_t* buf, uint32_t count) {
+    return xfer(sector, buf, 0, count);
+}
+
+uint8_t SD_WriteBlock(uint32_t sector, const uint8_t* buf) {
+    return xfer(sector, 0, buf, 1);
+}
+
+uint8_t SD_WriteMultiBlock(uint32_t sector, const uint8_t* buf, uint32_t count) {
+    return xfer(sector, 0, buf, count);
+}
+
+int SD_WriteBusy(void) {
+    return 0;
+}
+
+uint8_t SD_Sync(void) {
+    if (img)
+        fflush(img);
+    return SD_OK;
+}
+
+uint8_t SD_ReadAsync(uint32_t sector, uint8_t* buf, uint32_t count, SD_Callback done) {
+    if (reqPending)
+        return SD_BUSY;
+
+    reqStatus = xfer(sector, buf, 0, count);
+    reqDone = done;
+    reqPending = 1;
+    return SD_OK;
+}
+
+uint8_t SD_Poll(void) {
+    if (reqPending) {
+        reqPending = 0;
+        if (reqDone)
+            reqDone(reqStatus);
+    }
+    return reqStatus;
+}
+
+int SD_AsyncBusy(void) {
+    return reqPending;
+}
+
+void SD_AsyncWait(void) {
+    SD_Poll();
+}
+
+uint32_t SD_GetClockHz(void) {
+    return sd_image_cfg.clock_hz;
+}
+
+// The model runs at its one clock: nothing to step down to
+uint8_t SD_StepDown(void) {
+    return SD_ERROR;
+}
+
+uint32_t SD_GetCrcErrors(void) {
+    return 0;
+}
+
+const SD_InitStats* SD_GetInitStats(void) {
+    return &initStats;
+}
+
+const SD_CardInfo* SD_GetCardInfo(void) {
+    return &cardInfo;
+}
+
+uint8_t SD_GetCardType(void) {
+    return cardInfo.type;
+}
+
+uint32_t SD_GetSectorCount(void) {
+    return imgSectors;
+}
+
+uint32_t SD_GetEraseBlock(void) {
+    return 64;
+}
@@ -0,0 +1,37 @@
+#ifndef SD_IMAGE_H
+#define SD_IMAGE_H
+
+#include <stdint.h>
+
+// Card model: every command costs cmd_latency_us (+ up to jitter_us),
+// every byte on the bus costs 8 / clock_hz. A spike of spike_us is added
+// to every spike_every'th command (0 = never). realtime sleeps the
+// modelled time instead of only accounting it.
+typedef struct {
+    uint32_t cmd_latency_us;
+    uint32_t jitter_us;
+    uint32_t clock_hz;
+    uint32_t spike_every;
+    uint32_t spike_us;
+    int      realtime;
+} SD_ImageConfig;
+
+#define SD_IMAGE_HIST_BUCKETS 16    // log2(us) buckets: <1, <2, <4 ... >=16 ms
+
+typedef struct {
+    uint32_t commands;
+    uint32_t sectors_read;
+    uint32_t sectors_written;
+    double   card_us;               // modelled card time
+    uint32_t hist[SD_IMAGE_HIST_BUCKETS];
+} SD_ImageStats;
+
+extern SD_ImageConfig sd_image_cfg;
+extern SD_ImageStats sd_image_stats;
+
+int sd_image_open(const char* path);
+int sd_image_create(const char* path, uint32_t sectors);
+void sd_image_close(void);
+void sd_image_reset_stats(void);
+
+#endif
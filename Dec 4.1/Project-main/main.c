@@ -3,6 +3,26 @@
 #include "wav.h"
 #include "timer.h"
 #include "spi_fpga.h"
+#include "audio_ring.h"
+#include "pcm_convert.h"
+#include "track_switch.h"
+
+// Per-sample mode takes audio only through fpga_stream()
+#if FPGA_SAMPLE_DMA && !AUDIO_RING_SECTORS && !AUDIO_USE_FORWARD
+#error "FPGA_SAMPLE_DMA needs the audio ring or AUDIO_USE_FORWARD"
+#endif
+
+// Audio goes to the link through the format conversion stage
+#if PCM_CONVERT
+#define AUDIO_SINK pcm_stream
+#else
+#define AUDIO_SINK fpga_stream
+#endif
+
+// Boot-time cycles/sample report for each conversion
+#ifndef PCM_BENCH
+#define PCM_BENCH 0
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////
 // Global Variables
@@ -10,16 +30,15 @@
 FATFS FatFs;
 FIL file;
 FRESULT fres;
+#if !AUDIO_RING_SECTORS && !AUDIO_USE_FORWARD
 BYTE audio_buffer[512];
+#endif
 UINT bytesRead;
 
 volatile uint16_t f_read_counter = 0;
 volatile int f_read_ready_flag = 0;
 volatile uint16_t adc_counter = 0;
-
-char wav_files[MAX_WAV_FILES][32];
-uint8_t wav_file_count = 0;
-int8_t current_file_index = -1;
+volatile uint32_t audio_tick_count = 0;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Delay
@@ -86,6 +105,94 @@ uint8_t scale_1p5_and_clamp(uint8_t v) {
     return (uint8_t)scaled;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// SD init timing report
+///////////////////////////////////////////////////////////////////////////////
+void print_sd_init_stats(void) {
+    static const char* const names[SD_PHASES] = {
+        "power-up", "CMD0", "CMD8", "ACMD41", "CMD58", "speed"
+    };
+    const SD_InitStats* st = SD_GetInitStats();
+
+    printf("SD init: %lu us at %lu Hz, CMD0 x%u, ACMD41 x%u\n",
+           (unsigned long)st->total_us, (unsigned long)st->init_clock_hz,
+           st->cmd0_tries, st->acmd41_polls);
+
+    for (int i = 0; i < SD_PHASES; i++)
+        printf("  %-8s %lu us\n", names[i], (unsigned long)st->phase_us[i]);
+
+    if (st->failed < SD_PHASES)
+        printf("  failed in %s\n", names[st->failed]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Streaming cost: DWT cycles spent in wav_forward()/wav_read() (storage
+// stack, plus the SPI1 transmit in forward mode, only its start with
+// FPGA_USE_DMA), reported per track to compare build profiles, with the
+// audio ring's fill range
+///////////////////////////////////////////////////////////////////////////////
+static uint64_t stream_cycles = 0;
+static uint32_t stream_bytes = 0;
+
+void print_stream_stats(void) {
+    if (stream_bytes >= 512)
+        printf("Stream: %lu cycles/sector, link ran dry %lu times\n",
+               (unsigned long)(stream_cycles * 512 / stream_bytes),
+               (unsigned long)fpga_stream_underruns());
+    stream_cycles = 0;
+    stream_bytes = 0;
+
+#if AUDIO_RING_SECTORS
+    const AudioRingStats* rs = audio_ring_stats();
+    printf("Ring: %lu-%lu of %u bytes, %lu underruns, %lu reads\n",
+           (unsigned long)rs->low_water, (unsigned long)rs->high_water,
+           AUDIO_RING_SECTORS * 512, (unsigned long)rs->underruns, (unsigned long)rs->reads);
+    audio_ring_reset_stats();
+#endif
+}
+
+#if PCM_CONVERT && PCM_BENCH
+///////////////////////////////////////////////////////////////////////////////
+// Conversion cost: DWT cycles per output sample of each input format,
+// SIMD and reference loops over the same block, checked against each
+// other. Clobbers the converter's format: run before the first track.
+///////////////////////////////////////////////////////////////////////////////
+#define PCM_BENCH_FRAMES 256
+
+void print_convert_bench(void) {
+    static BYTE in[PCM_BENCH_FRAMES * 8];
+    static int16_t out[2][PCM_BENCH_FRAMES];
+    uint32_t seed = 1;
+
+    for (UINT i = 0; i < sizeof(in); i++) {
+        seed = seed * 1103515245u + 12345u;
+        in[i] = (BYTE)(seed >> 16);
+    }
+
+    for (int k = 0; k < PCM_FORMATS; k++) {
+        // Float input: magnitudes 0.5 to 2, half of them clipped
+        if (pcm_formats[k].format_tag == WAV_FORMAT_FLOAT)
+            for (UINT i = 3; i < sizeof(in); i += 4)
+                in[i] = (in[i] & 0x80) | 0x3F;
+
+        pcm_set_format(&pcm_formats[k]);
+
+        uint32_t c0 = DWT_Now();
+        pcm_convert(in, PCM_BENCH_FRAMES, out[0]);
+        uint32_t c1 = DWT_Now();
+        pcm_convert_ref(&pcm_formats[k], in, PCM_BENCH_FRAMES, out[1]);
+        uint32_t c2 = DWT_Now();
+
+        printf("Convert %-10s %3lu.%02lu cycles/sample, reference %3lu.%02lu%s\n", pcm_format_names[k],
+               (unsigned long)((c1 - c0) / PCM_BENCH_FRAMES),
+               (unsigned long)((c1 - c0) % PCM_BENCH_FRAMES * 100 / PCM_BENCH_FRAMES),
+               (unsigned long)((c2 - c1) / PCM_BENCH_FRAMES),
+               (unsigned long)((c2 - c1) % PCM_BENCH_FRAMES * 100 / PCM_BENCH_FRAMES),
+               memcmp(out[0], out[1], sizeof(out[0])) ? "  MISMATCH" : "");
+    }
+}
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////
 // System Clock
 ///////////////////////////////////////////////////////////////////////////////
@@ -122,6 +229,14 @@ int main(void) {
     SystemClock_Config();
     SystemCoreClockUpdate();
 
+    // Boot timestamp base for the SD init phases and first-sample latency
+    DWT_Init();
+    uint32_t boot = DWT_Now();
+    int first_sample = 1;
+#if AUDIO_RING_SECTORS
+    int reading = 0;        // producer read in flight (-1: failed to start)
+#endif
+
     initSPI3(0b010, 0, 0);
     initSPI1_FPGA();
 
@@ -139,12 +254,46 @@ int main(void) {
     Button_Init();
 
     fres = f_mount(&FatFs, "", 1);
-    if (fres != FR_OK) { blink_error(4); while(1); }
+    if (fres != FR_OK) {
+        if (SD_GetInitStats()->failed < SD_PHASES)
+            print_sd_init_stats();
+        blink_error(4);
+        while(1);
+    }
+
+    DWORD sd_clock;
+    if (disk_ioctl(0, SD_GET_CLOCK, &sd_clock) == RES_OK)
+        printf("SD clock: %lu Hz\n", (unsigned long)sd_clock);
+
+    print_sd_init_stats();
+
+    // A playlist on the card selects the tracks; otherwise the track table
+    // from the on-card index, scanning only when the volume changed
+    if (open_playlist() == 0) {
+        printf("Playlist: %s\n", WAV_PLAYLIST);
+    } else {
+        if (load_track_index() == 0)
+            printf("Track index: %lu tracks\n", (unsigned long)wav_track_count);
+        else {
+            scan_wav_files();
+            printf("Scanned: %lu tracks\n", (unsigned long)wav_track_count);
+        }
+        if (wav_track_count == 0) { blink_error(8); while(1); }
+    }
+
+#if PCM_CONVERT && PCM_BENCH
+    print_convert_bench();
+#endif
 
-    scan_wav_files();
-    if (wav_file_count == 0) { blink_error(8); while(1); }
+    if (open_next_wav_file() != 0) { blink_error(8); while(1); }
+#if PCM_CONVERT
+    pcm_reset(fpga_stream);
+#endif
+    track_opened(0);
 
-    open_next_wav_file();
+    // First buffer goes out now rather than 512 ticks after TIM2 starts
+    f_read_ready_flag = 1;
+    fpga_stream_reset();
     TIM2_Init_Default();
 
     printf("Streaming Audio & ADC to FPGA...\n");
@@ -153,27 +302,135 @@ int main(void) {
 
         if (check_button()) {
             printf("Button pressed! Skipping track...\n");
+            print_stream_stats();
+
+            // The audio DMA may still be reading the buffer about to be reused
+            spi1_dma_wait();
 
             if (open_next_wav_file() == 0) {
+#if PCM_CONVERT
+                pcm_reset(fpga_stream);
+#endif
+                track_opened(0);
+#if AUDIO_RING_SECTORS
+                audio_ring_reset();
+                reading = 0;
+#endif
                 f_read_counter = 0;
             }
         }
 
+#if AUDIO_RING_SECTORS
+        // AUDIO TO FPGA: ring → SPI1, as much as the FPGA FIFO has room
+        // for, every pass, while the card works on the next read into
+        // the free sectors. Tracks follow each other in the ring without
+        // a gap.
+        UINT sent = audio_ring_drain(AUDIO_SINK, track_hold());
+        track_sent(sent);
+        if (sent && first_sample) {
+            printf("Boot to first sample: %lu us\n", (unsigned long)DWT_ElapsedUs(boot));
+            first_sample = 0;
+        }
+
+        UINT space;
+        BYTE* slot;
+        uint32_t c0 = DWT_Now();
+
+        if (!reading && (slot = audio_ring_space(&space)) != 0)
+            reading = (wav_read_start(slot, space) == 0) ? 1 : -1;
+
+        if (reading) {
+            int r = (reading < 0) ? -1 : wav_read_poll(&bytesRead);
+            stream_cycles += DWT_Now() - c0;
+
+            if (r == 0 && bytesRead) {
+                stream_bytes += bytesRead;
+                audio_ring_commit(bytesRead);
+                reading = 0;
+            } else if (r != 1) {
+                // End of the track, or a read that failed at the baseline
+                // SD clock: the ring drains while the next opens
+                reading = 0;
+                audio_ring_commit(0);
+                print_stream_stats();
+                if (open_next_wav_file() < 0) {
+                    blink_error(7);
+                    while (1);
+                }
+                track_opened(audio_ring_unsent());
+            }
+        }
+#endif
+
         if (f_read_ready_flag) {
             f_read_ready_flag = 0;
 
-            fres = f_read(&file, audio_buffer, 512, &bytesRead);
-
-            if (fres != FR_OK || bytesRead == 0) {
+#if !AUDIO_RING_SECTORS
+            // AUDIO TO FPGA
+            // One period (512 ticks, 256 samples) of input: more than 512
+            // bytes when each frame converts to a smaller link sample
+            UINT budget = wav_format()->block_align * (FPGA_FIFO_BYTES / 2);
+            UINT done = 0;
+
+#if AUDIO_USE_FORWARD
+            // Sector buffer → SPI1, as much as the FPGA FIFO has room for.
+            // With DMA each call is one burst: let it finish and go on
+            // until the link takes nothing more.
+            do {
+                spi1_dma_wait();
+                uint32_t c0 = DWT_Now();
+                fres = wav_forward(AUDIO_SINK, budget - done, &bytesRead);
+                stream_cycles += DWT_Now() - c0;
+                stream_bytes += bytesRead;
+                done += bytesRead;
+            } while (fres == FR_OK && bytesRead && done < budget && !wav_eof());
+
+            if (fres != FR_OK || wav_eof()) {
+                print_stream_stats();
+                spi1_dma_wait();
                 if (open_next_wav_file() < 0) {
                     blink_error(7);
                     while (1);
                 }
-                f_read(&file, audio_buffer, 512, &bytesRead);
+                track_opened(0);
+                wav_forward(AUDIO_SINK, FPGA_FIFO_BYTES, &bytesRead);
+            }
+#else
+            while (done < budget) {
+                UINT n = budget - done;
+
+                uint32_t c0 = DWT_Now();
+                fres = wav_read(audio_buffer, (n < sizeof(audio_buffer)) ? n : sizeof(audio_buffer), &bytesRead);
+                stream_cycles += DWT_Now() - c0;
+                stream_bytes += bytesRead;
+
+                if (fres != FR_OK || bytesRead == 0) {
+                    print_stream_stats();
+                    if (open_next_wav_file() < 0) {
+                        blink_error(7);
+                        while (1);
+                    }
+                    track_opened(0);
+                    continue;
+                }
+                done += bytesRead;
+
+#if PCM_CONVERT
+                // Blocking, as send_spi_data() is: all of it, then the stage
+                for (UINT sent = 0; sent < bytesRead;)
+                    sent += pcm_stream(audio_buffer + sent, bytesRead - sent);
+                while (!pcm_stream(0, 0));
+#else
+                send_spi_data(audio_buffer, bytesRead, GPIO_ODR_OD2);
+#endif
             }
+#endif
 
-            // AUDIO TO FPGA
-            send_spi_data(audio_buffer, bytesRead, GPIO_ODR_OD2);
+            if (first_sample) {
+                printf("Boot to first sample: %lu us\n", (unsigned long)DWT_ElapsedUs(boot));
+                first_sample = 0;
+            }
+#endif
 
             // SENSOR TO FPGA
             uint8_t sensor_val = Read_ADC_Channel(ADC_PIN_SEND);
@@ -28,8 +28,32 @@
 #define BUTTON_PIN_PA3      3
 #define DEBOUNCE_DELAY      5000
 
-// WAV file limit
-#define MAX_WAV_FILES 16
+// Audio ring between the card and the FPGA, in 512-byte sectors: SD
+// reads run ahead into it whenever a sector is free and the FPGA is fed
+// from it as its FIFO drains, so card latency spikes eat into the ring
+// instead of the FIFO. 0 = no ring, stream per AUDIO_USE_FORWARD.
+#ifndef AUDIO_RING_SECTORS
+#ifdef RAM_LEAN
+#define AUDIO_RING_SECTORS 16
+#else
+#define AUDIO_RING_SECTORS 8
+#endif
+#endif
+
+// Without the ring: stream audio with f_forward() straight from the
+// FatFs sector buffer (0 = wav_read() into audio_buffer, then
+// send_spi_data())
+#ifndef AUDIO_USE_FORWARD
+#define AUDIO_USE_FORWARD 1
+#endif
+
+// RAM_LEAN profile ("Release Lean" configuration): FatFs in its tiny
+// buffer configuration and smaller track window and sector cache; the
+// RAM saved goes to a deeper audio ring. Without the ring FatFs.win is
+// the only sector buffer between the card and the FPGA.
+#if defined(RAM_LEAN) && !AUDIO_RING_SECTORS && !AUDIO_USE_FORWARD
+#error "RAM_LEAN without the audio ring streams from FatFs.win: AUDIO_USE_FORWARD must be 1"
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////
 // Global Variables (extern; defined in main.c)
@@ -44,10 +68,7 @@ extern UINT bytesRead;
 extern volatile uint16_t f_read_counter;
 extern volatile int f_read_ready_flag;
 extern volatile uint16_t adc_counter;
-
-extern char wav_files[MAX_WAV_FILES][32];
-extern uint8_t wav_file_count;
-extern int8_t current_file_index;
+extern volatile uint32_t audio_tick_count;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Function Prototypes (local only)
@@ -66,5 +87,8 @@ int check_button(void);
 
 // Helpers
 uint8_t scale_1p5_and_clamp(uint8_t v);
+void print_sd_init_stats(void);
+void print_stream_stats(void);
+void print_convert_bench(void);
 
 #endif // MAIN_H
@@ -0,0 +1,342 @@
+#include "pcm_convert.h"
+
+#define KIND_S16_MONO 2     // what the link carries: copied, not converted
+
+// In kind order: sample type (u8, s16, s24, f32) * 2 + channels - 1
+const WAV_Format pcm_formats[PCM_FORMATS] = {
+    { 48000, 0, WAV_FORMAT_PCM,   1,  8, 1 },
+    { 48000, 0, WAV_FORMAT_PCM,   2,  8, 2 },
+    { 48000, 0, WAV_FORMAT_PCM,   1, 16, 2 },
+    { 48000, 0, WAV_FORMAT_PCM,   2, 16, 4 },
+    { 48000, 0, WAV_FORMAT_PCM,   1, 24, 3 },
+    { 48000, 0, WAV_FORMAT_PCM,   2, 24, 6 },
+    { 48000, 0, WAV_FORMAT_FLOAT, 1, 32, 4 },
+    { 48000, 0, WAV_FORMAT_FLOAT, 2, 32, 8 },
+};
+
+const char* const pcm_format_names[PCM_FORMATS] = {
+    "u8 mono", "u8 stereo", "s16 mono", "s16 stereo",
+    "s24 mono", "s24 stereo", "f32 mono", "f32 stereo",
+};
+
+static int pcm_kind(const WAV_Format* fmt) {
+    int type;
+
+    if (fmt->channels < 1 || fmt->channels > 2)
+        return -1;
+
+    if (fmt->format_tag == WAV_FORMAT_FLOAT)
+        type = (fmt->bits == 32) ? 3 : -1;
+    else if (fmt->bits == 8)
+        type = 0;
+    else if (fmt->bits == 16)
+        type = 1;
+    else if (fmt->bits == 24)
+        type = 2;
+    else
+        type = -1;
+
+    return (type < 0) ? -1 : type * 2 + fmt->channels - 1;
+}
+
+int pcm_supported(const WAV_Format* fmt) {
+#if PCM_CONVERT
+    return pcm_kind(fmt) >= 0;
+#else
+    return pcm_kind(fmt) == KIND_S16_MONO;
+#endif
+}
+
+#if PCM_CONVERT
+
+// -----------------------------------------------------------------------------
+// Reference conversion, one sample at a time
+// 8-bit is offset binary; 24-bit rounds to the nearest 16-bit step;
+// float is scaled by 32768 and truncated, out of range clipped and NaN 0;
+// stereo averages the converted channels, rounding down.
+// -----------------------------------------------------------------------------
+static int16_t from_u8(const BYTE* p) {
+    return (int16_t)((p[0] - 128) * 256);
+}
+
+static int16_t from_s16(const BYTE* p) {
+    return (int16_t)(p[0] | (p[1] << 8));
+}
+
+static int16_t from_s24(const BYTE* p) {
+    int32_t s = (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24)) >> 8;
+
+    s = (s + 128) >> 8;
+    return (int16_t)((s > 32767) ? 32767 : s);
+}
+
+static int32_t q15(float f) {
+    float s = f * 32768.0f;
+
+    if (s >= 32767.0f)
+        return 32767;
+    if (s <= -32768.0f)
+        return -32768;
+    return (s == s) ? (int32_t)s : 0;
+}
+
+static int16_t from_f32(const BYTE* p) {
+    uint32_t u = p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    float f;
+
+    memcpy(&f, &u, sizeof(f));
+    return (int16_t)q15(f);
+}
+
+static int16_t (* const ref_sample[4])(const BYTE*) = { from_u8, from_s16, from_s24, from_f32 };
+
+static void convert_ref(int kind, const BYTE* in, UINT frames, int16_t* out) {
+    int16_t (*sample)(const BYTE*) = ref_sample[kind / 2];
+    UINT size = pcm_formats[kind].bits / 8;
+
+    if (kind & 1) {
+        for (UINT i = 0; i < frames; i++, in += 2 * size)
+            out[i] = (int16_t)((sample(in) + sample(in + size)) >> 1);
+    } else {
+        for (UINT i = 0; i < frames; i++, in += size)
+            out[i] = sample(in);
+    }
+}
+
+#if PCM_USE_DSP
+// -----------------------------------------------------------------------------
+// Packed-SIMD conversion: whole words in, two samples per word out.
+// Input may sit at any byte offset (a frame split across two reads); the
+// M4 takes unaligned single-word loads and stores. Leftover frames go
+// through the reference loop.
+// -----------------------------------------------------------------------------
+#define LOAD32(p)       __UNALIGNED_UINT32_READ(p)
+#define STORE32(p, v)   __UNALIGNED_UINT32_WRITE(p, v)
+
+// Bytes 0, 2 and 1, 3 of w as halfwords, offset binary to signed
+#define U8_EVEN(w)      ((__UXTB16(w) << 8) ^ 0x80008000u)
+#define U8_ODD(w)       ((__UXTB16(__ROR(w, 8)) << 8) ^ 0x80008000u)
+
+// 24-bit sample shifted to the top of a word, rounded and saturated
+#define S24_ROUND(v)    __SSAT((((int32_t)(v) >> 1) + 0x4000) >> 15, 16)
+
+static UINT u8_mono(const BYTE* in, UINT frames, int16_t* out) {
+    UINT n = frames / 4;
+
+    while (n--) {
+        uint32_t w = LOAD32(in);
+        uint32_t even = U8_EVEN(w), odd = U8_ODD(w);
+        STORE32(out, __PKHBT(even, odd, 16));
+        STORE32(out + 2, __PKHTB(odd, even, 16));
+        in += 4;
+        out += 4;
+    }
+    return frames & ~3u;
+}
+
+static UINT u8_stereo(const BYTE* in, UINT frames, int16_t* out) {
+    UINT n = frames / 2;
+
+    while (n--) {
+        uint32_t w = LOAD32(in);
+        STORE32(out, __SHADD16(U8_EVEN(w), U8_ODD(w)));
+        in += 4;
+        out += 2;
+    }
+    return frames & ~1u;
+}
+
+static UINT s16_stereo(const BYTE* in, UINT frames, int16_t* out) {
+    UINT n = frames / 2;
+
+    while (n--) {
+        uint32_t w0 = LOAD32(in), w1 = LOAD32(in + 4);
+        STORE32(out, __SHADD16(__PKHBT(w0, w1, 16), __PKHTB(w1, w0, 16)));
+        in += 8;
+        out += 2;
+    }
+    return frames & ~1u;
+}
+
+// Four packed 24-bit samples in three words, each to the top of a word
+#define S24_UNPACK(in, s0, s1, s2, s3) do {                     \
+        uint32_t w0 = LOAD32(in), w1 = LOAD32(in + 4);          \
+        uint32_t w2 = LOAD32(in + 8);                           \
+        s0 = S24_ROUND(w0 << 8);                                \
+        s1 = S24_ROUND((w1 << 16) | ((w0 >> 16) & 0xFF00u));   \
+        s2 = S24_ROUND((w2 << 24) | ((w1 >> 8) & 0xFFFF00u));  \
+        s3 = S24_ROUND(w2 & 0xFFFFFF00u);                       \
+    } while (0)
+
+static UINT s24_mono(const BYTE* in, UINT frames, int16_t* out) {
+    UINT n = frames / 4;
+    int32_t s0, s1, s2, s3;
+
+    while (n--) {
+        S24_UNPACK(in, s0, s1, s2, s3);
+        STORE32(out, __PKHBT(s0, s1, 16));
+        STORE32(out + 2, __PKHBT(s2, s3, 16));
+        in += 12;
+        out += 4;
+    }
+    return frames & ~3u;
+}
+
+static UINT s24_stereo(const BYTE* in, UINT frames, int16_t* out) {
+    UINT n = frames / 2;
+    int32_t l0, r0, l1, r1;
+
+    while (n--) {
+        S24_UNPACK(in, l0, r0, l1, r1);
+        STORE32(out, __SHADD16(__PKHBT(l0, l1, 16), __PKHBT(r0, r1, 16)));
+        in += 12;
+        out += 2;
+    }
+    return frames & ~1u;
+}
+
+// Float to integer is the FPU's; the samples are packed and averaged in pairs
+static float load_f32(const BYTE* p) {
+    uint32_t u = LOAD32(p);
+    float f;
+
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static UINT f32_mono(const BYTE* in, UINT frames, int16_t* out) {
+    UINT n = frames / 2;
+
+    while (n--) {
+        STORE32(out, __PKHBT(q15(load_f32(in)), q15(load_f32(in + 4)), 16));
+        in += 8;
+        out += 2;
+    }
+    return frames & ~1u;
+}
+
+static UINT f32_stereo(const BYTE* in, UINT frames, int16_t* out) {
+    UINT n = frames / 2;
+
+    while (n--) {
+        uint32_t l = __PKHBT(q15(load_f32(in)), q15(load_f32(in + 8)), 16);
+        uint32_t r = __PKHBT(q15(load_f32(in + 4)), q15(load_f32(in + 12)), 16);
+        STORE32(out, __SHADD16(l, r));
+        in += 16;
+        out += 2;
+    }
+    return frames & ~1u;
+}
+
+static UINT s16_mono(const BYTE* in, UINT frames, int16_t* out) {
+    memcpy(out, in, frames * 2);
+    return frames;
+}
+
+static UINT (* const dsp_loop[PCM_FORMATS])(const BYTE*, UINT, int16_t*) = {
+    u8_mono, u8_stereo, s16_mono, s16_stereo, s24_mono, s24_stereo, f32_mono, f32_stereo,
+};
+#endif
+
+
+// -----------------------------------------------------------------------------
+// Stream state
+// -----------------------------------------------------------------------------
+static UINT (*stream_link)(const BYTE*, UINT);
+static int format_kind = KIND_S16_MONO;
+static UINT frame = 2;              // input bytes per frame
+
+static int16_t stage[PCM_STAGE_BYTES / 2];
+static UINT stage_len = 0;          // bytes converted
+static UINT stage_sent = 0;         // ... and taken by the link
+
+static BYTE carry[8];               // start of a frame split across two reads
+static UINT carry_len = 0;
+
+void pcm_reset(UINT (*sink)(const BYTE*, UINT)) {
+    stream_link = sink;
+    stage_len = stage_sent = 0;
+    carry_len = 0;
+}
+
+void pcm_set_format(const WAV_Format* fmt) {
+    int k = pcm_kind(fmt);
+
+    format_kind = (k < 0) ? KIND_S16_MONO : k;
+    frame = pcm_formats[format_kind].block_align;
+    carry_len = 0;
+}
+
+void pcm_convert(const BYTE* in, UINT frames, int16_t* out) {
+#if PCM_USE_DSP
+    UINT done = dsp_loop[format_kind](in, frames, out);
+    convert_ref(format_kind, in + done * frame, frames - done, out + done);
+#else
+    convert_ref(format_kind, in, frames, out);
+#endif
+}
+
+void pcm_convert_ref(const WAV_Format* fmt, const BYTE* in, UINT frames, int16_t* out) {
+    int k = pcm_kind(fmt);
+
+    convert_ref((k < 0) ? KIND_S16_MONO : k, in, frames, out);
+}
+
+
+// -----------------------------------------------------------------------------
+// Sink: the link gets the stage once it has taken the last one (a DMA
+// link reads it until it reports ready again). 16-bit mono passes
+// straight through once the stage is empty.
+// -----------------------------------------------------------------------------
+UINT pcm_stream(const BYTE* buf, UINT len) {
+    UINT used = 0, room = PCM_STAGE_BYTES / 2, frames;
+    int16_t* out = stage;
+
+    if (stage_sent < stage_len) {
+        stage_sent += stream_link((const BYTE*)stage + stage_sent, stage_len - stage_sent);
+        if (stage_sent < stage_len)
+            return 0;
+    }
+
+    if (format_kind == KIND_S16_MONO)
+        return stream_link(buf, len);
+    if (!stream_link(0, 0))
+        return 0;
+    if (len == 0)
+        return 1;
+
+    // Finish a frame split across two reads
+    if (carry_len) {
+        used = frame - carry_len;
+        if (used > len)
+            used = len;
+        memcpy(carry + carry_len, buf, used);
+        carry_len += used;
+        if (carry_len < frame)
+            return used;
+
+        pcm_convert(carry, 1, out++);
+        room--;
+        carry_len = 0;
+    }
+
+    frames = (len - used) / frame;
+    if (frames > room)
+        frames = room;
+    pcm_convert(buf + used, frames, out);
+    out += frames;
+    used += frames * frame;
+
+    // Keep the start of a frame the read cut off
+    if (len - used < frame) {
+        carry_len = len - used;
+        memcpy(carry, buf + used, carry_len);
+        used = len;
+    }
+
+    stage_len = (UINT)(out - stage) * 2;
+    stage_sent = stage_len ? stream_link((const BYTE*)stage, stage_len) : 0;
+    return used;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef PCM_CONVERT_H
+#define PCM_CONVERT_H
+
+#include "wav.h"
+
+// Conversion stage between the audio read buffers and the FPGA link,
+// which carries 16-bit mono: 8-bit unsigned, 16-bit and 24-bit packed
+// PCM and 32-bit float, mono or stereo (averaged to mono). 0: only
+// 16-bit mono files are played.
+#ifndef PCM_CONVERT
+#define PCM_CONVERT 1
+#endif
+
+// Packed-SIMD loops (Cortex-M4 DSP extension), else the portable
+// reference loops, which the host build uses. Both give the same samples.
+#ifndef PCM_USE_DSP
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP == 1
+#define PCM_USE_DSP 1
+#else
+#define PCM_USE_DSP 0
+#endif
+#endif
+
+// Converted samples staged for the link, in bytes
+#ifndef PCM_STAGE_BYTES
+#ifdef RAM_LEAN
+#define PCM_STAGE_BYTES 256
+#else
+#define PCM_STAGE_BYTES 512
+#endif
+#endif
+
+// Formats converted, for the benchmarks
+#define PCM_FORMATS 8
+extern const WAV_Format pcm_formats[PCM_FORMATS];
+extern const char* const pcm_format_names[PCM_FORMATS];
+
+// A format the link can play, converted or as is
+int pcm_supported(const WAV_Format* fmt);
+
+// Start a stream to link (fpga_stream) in 16-bit mono: nothing staged or
+// part of a frame held back. pcm_set_format() switches the input format
+// at a frame boundary, after the last track's samples went through.
+void pcm_reset(UINT (*link)(const BYTE*, UINT));
+void pcm_set_format(const WAV_Format* fmt);
+
+// f_forward()/audio_ring_drain() sink: converts into the stage and hands
+// that to the link. Returns input bytes taken, 0 while the link still has
+// staged samples to take; (0, 0) asks whether it is ready.
+UINT pcm_stream(const BYTE* buf, UINT len);
+
+// frames of the current format to 16-bit mono samples; the reference
+// loop takes any format, so a check need not switch the stream's
+void pcm_convert(const BYTE* in, UINT frames, int16_t* out);
+void pcm_convert_ref(const WAV_Format* fmt, const BYTE* in, UINT frames, int16_t* out);
+
+#endif
@@ -1,6 +1,36 @@
 #include "spi_fpga.h"
 #include "stm32l432xx.h"
 #include "main.h"
+#include <string.h>
+
+// Audio bytes sent since fpga_stream_reset(), and the TIM2 tick count
+// the FIFO was empty at. The FPGA takes one word per two ticks, i.e.
+// one byte per tick, so sent - (ticks - base) is the FIFO fill.
+static uint32_t stream_sent = 0;
+static uint32_t stream_base = 0;
+
+// SPI1 TX DMA state (DMA1 CH3, request 1)
+static volatile uint8_t dma_busy = 0;
+static volatile uint8_t dma_queued = 0;    // all bytes handed to SPI1
+static volatile uint8_t dma_error = 0;
+static uint32_t dma_cs = 0;
+static void (*dma_notify)(uint8_t event) = 0;
+
+#if FPGA_SAMPLE_DMA
+// Per-sample DMA (DMA1 CH2, request 4 = TIM2_UP): circular over
+// sample_buf, which it has read laps times since fpga_stream_reset()
+#define SAMPLE_HALF (FPGA_SAMPLE_BUF_BYTES / 2)
+#define SAMPLE_AHEAD (SAMPLE_HALF - 32)     // less the clearing IRQ's latency
+static uint8_t sample_buf[FPGA_SAMPLE_BUF_BYTES];
+static volatile uint32_t sample_laps = 0;
+
+// SPI1 runs at fPCLK/32: a byte is 256 TIM2 (core clock) cycles on the
+// wire, plus the chip-select edges and polling around a slot
+#define SLOT_BYTE_CYCLES 256
+#define SLOT_MARGIN 64
+#endif
+static uint32_t stream_underruns = 0;   // times the link ran dry mid-stream
+static uint8_t stream_dry = 0;
 
 // -----------------------------------------------------------------------------
 // Configure SPI1 for streaming audio + sensor data to FPGA
@@ -24,32 +54,309 @@ void initSPI1_FPGA(void) {
     // Enable SPI1 clock
     RCC->APB2ENR |= RCC_APB2ENR_SPI1EN;
 
-    // Configure SPI1
-    SPI1->CR1 = SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI | SPI_CR1_BR_2;  // slow baud
+    // Configure SPI1: transmit-only on MOSI, so no RXNE/OVR to service
+    SPI1->CR1 = SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI | SPI_CR1_BR_2 |  // slow baud
+                SPI_CR1_BIDIMODE | SPI_CR1_BIDIOE;
     SPI1->CR2 = (0x7 << SPI_CR2_DS_Pos) | SPI_CR2_FRXTH;  // 8-bit
 
     SPI1->CR1 |= SPI_CR1_SPE;   // enable SPI
+
+#if FPGA_USE_DMA
+    initSPI1_DMA();
+#endif
+}
+
+
+// -----------------------------------------------------------------------------
+// Wait for the TX FIFO and shift register to empty, before CS goes high
+// -----------------------------------------------------------------------------
+static void spi1_tx_flush(void) {
+    while (SPI1->SR & SPI_SR_FTLVL);
+    while (SPI1->SR & SPI_SR_BSY);
 }
 
 
 // -----------------------------------------------------------------------------
 // Send len bytes to FPGA using SPI1 + external chip select
 // -----------------------------------------------------------------------------
-void send_spi_data(uint8_t *buf, uint16_t len, uint32_t cs_pin_mask) {
+void send_spi_data(const uint8_t *buf, uint16_t len, uint32_t cs_pin_mask) {
+
+    // The link may still be busy with a DMA transfer
+    spi1_dma_wait();
+
+#if FPGA_SAMPLE_DMA
+    // Per-sample mode: wait for a tick that follows a whole word and has
+    // time left for the transfer, then deselect the audio receiver for
+    // it; it must be done before the next update hands SPI1 another
+    // byte. A tick too short to hold the audio byte and this transfer
+    // (high rates, or the pot near full speed) has no slot: dropped.
+    uint32_t need = len * SLOT_BYTE_CYCLES + SLOT_MARGIN;
+
+    if (SLOT_BYTE_CYCLES + need + SLOT_MARGIN > TIM2->ARR)
+        return;
+
+    for (;;) {
+        __disable_irq();
+        if (TIM2->ARR - TIM2->CNT >= need && !(DMA1_Channel2->CNDTR & 1) &&
+            !(SPI1->SR & (SPI_SR_FTLVL | SPI_SR_BSY)))
+            break;
+        __enable_irq();
+    }
+    GPIOA->ODR |= GPIO_ODR_OD2;
+#endif
 
     // CS low
     GPIOA->ODR &= ~cs_pin_mask;
 
-    // Transmit
+    // Transmit, keeping the TX FIFO topped up
     for (uint16_t i = 0; i < len; i++) {
-
         while (!(SPI1->SR & SPI_SR_TXE));
         *(volatile uint8_t *)&SPI1->DR = buf[i];
-
-        while (!(SPI1->SR & SPI_SR_RXNE));
-        (void)*(volatile uint8_t *)&SPI1->DR;
     }
+    spi1_tx_flush();
 
     // CS high
     GPIOA->ODR |= cs_pin_mask;
+
+#if FPGA_SAMPLE_DMA
+    GPIOA->ODR &= ~GPIO_ODR_OD2;
+    __enable_irq();
+#endif
+}
+
+
+// -----------------------------------------------------------------------------
+// SPI1 TX DMA
+// -----------------------------------------------------------------------------
+void initSPI1_DMA(void) {
+
+    RCC->AHB1ENR |= RCC_AHB1ENR_DMA1EN;
+
+    // Request 1 on CH3 = SPI1_TX
+    DMA1_CSELR->CSELR &= ~DMA_CSELR_C3S;
+    DMA1_CSELR->CSELR |=  (1 << DMA_CSELR_C3S_Pos);
+
+    DMA1_Channel3->CPAR = (uint32_t)&SPI1->DR;
+
+    NVIC_SetPriority(DMA1_Channel3_IRQn, 1);
+    NVIC_EnableIRQ(DMA1_Channel3_IRQn);
+}
+
+// Send len bytes with chip select cs_pin_mask. notify (may be 0) runs
+// from the IRQ at the half-way point, and at the end from whichever of
+// spi1_dma_busy()/spi1_dma_wait() sees the link finish. -1 if a transfer
+// is still running.
+int spi1_dma_start(const uint8_t *buf, uint16_t len, uint32_t cs_pin_mask,
+                   void (*notify)(uint8_t event)) {
+
+    if (spi1_dma_busy() || len == 0)
+        return -1;
+
+    dma_notify = notify;
+    dma_cs = cs_pin_mask;
+    dma_queued = 0;
+    dma_error = 0;
+    dma_busy = 1;
+
+    GPIOA->ODR &= ~cs_pin_mask;
+
+    // Memory -> peripheral, 8-bit, interrupt on complete/error (and half)
+    DMA1_Channel3->CCR   = 0;
+    DMA1_Channel3->CMAR  = (uint32_t)buf;
+    DMA1_Channel3->CNDTR = len;
+    DMA1_Channel3->CCR   = DMA_CCR_PL_1 | DMA_CCR_DIR | DMA_CCR_MINC |
+                           DMA_CCR_TCIE | DMA_CCR_TEIE | (notify ? DMA_CCR_HTIE : 0);
+
+    DMA1_Channel3->CCR |= DMA_CCR_EN;
+    SPI1->CR2 |= SPI_CR2_TXDMAEN;
+    return 0;
+}
+
+// Complete means the last byte reached the TX FIFO: up to four more
+// (about 16 us at 2.5 MHz) are still to go out before CS may rise. That
+// wait is not spent in the IRQ, which would hold off TIM2; the transfer
+// is finished here once SPI1 is idle.
+int spi1_dma_busy(void) {
+    if (dma_busy && dma_queued && !(SPI1->SR & (SPI_SR_FTLVL | SPI_SR_BSY))) {
+        SPI1->CR2 &= ~SPI_CR2_TXDMAEN;
+        GPIOA->ODR |= dma_cs;
+        dma_busy = 0;
+
+        if (dma_notify)
+            dma_notify(dma_error ? SPI1_DMA_ERROR : SPI1_DMA_DONE);
+    }
+    return dma_busy;
+}
+
+// Block until the running transfer completes; 0 = ok, 1 = DMA error
+int spi1_dma_wait(void) {
+    while (spi1_dma_busy());
+    return dma_error;
+}
+
+void DMA1_Channel3_IRQHandler(void) {
+
+    uint32_t isr = DMA1->ISR;
+    DMA1->IFCR = DMA_IFCR_CGIF3;
+
+    if ((isr & DMA_ISR_HTIF3) && dma_notify)
+        dma_notify(SPI1_DMA_HALF);
+
+    // CS is released by spi1_dma_busy() once the TX FIFO has emptied
+    if (isr & (DMA_ISR_TCIF3 | DMA_ISR_TEIF3)) {
+        DMA1_Channel3->CCR &= ~DMA_CCR_EN;
+
+        if (isr & DMA_ISR_TEIF3)
+            dma_error = 1;
+        dma_queued = 1;
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// Per-sample DMA
+// -----------------------------------------------------------------------------
+#if FPGA_SAMPLE_DMA
+static void sample_dma_start(void) {
+
+    RCC->AHB1ENR |= RCC_AHB1ENR_DMA1EN;
+
+    DMA1_Channel2->CCR = 0;
+    memset(sample_buf, 0, sizeof(sample_buf));
+    sample_laps = 0;
+
+    // Request 4 on CH2 = TIM2_UP
+    DMA1_CSELR->CSELR &= ~DMA_CSELR_C2S;
+    DMA1_CSELR->CSELR |=  (4 << DMA_CSELR_C2S_Pos);
+
+    // Memory -> SPI1 data register, 8-bit, circular, interrupt per half
+    DMA1_Channel2->CPAR  = (uint32_t)&SPI1->DR;
+    DMA1_Channel2->CMAR  = (uint32_t)sample_buf;
+    DMA1_Channel2->CNDTR = FPGA_SAMPLE_BUF_BYTES;
+    DMA1_Channel2->CCR   = DMA_CCR_PL_1 | DMA_CCR_DIR | DMA_CCR_MINC | DMA_CCR_CIRC |
+                           DMA_CCR_HTIE | DMA_CCR_TCIE;
+
+    NVIC_SetPriority(DMA1_Channel2_IRQn, 1);
+    NVIC_EnableIRQ(DMA1_Channel2_IRQn);
+
+    // The audio receiver stays selected; words are framed by bit count
+    GPIOA->ODR &= ~GPIO_ODR_OD2;
+    DMA1_Channel2->CCR |= DMA_CCR_EN;
+}
+
+// Bytes the DMA has taken from sample_buf since the start. A wrap whose
+// interrupt is still pending shows as a full CNDTR with TCIF set.
+static uint32_t sample_read(void) {
+    uint32_t laps, left, pending;
+
+    do {
+        laps = sample_laps;
+        left = DMA1_Channel2->CNDTR;
+        pending = (DMA1->ISR & DMA_ISR_TCIF2) && left > SAMPLE_HALF;
+    } while (laps != sample_laps);
+
+    return (laps + pending) * FPGA_SAMPLE_BUF_BYTES + (FPGA_SAMPLE_BUF_BYTES - left);
+}
+
+// Clear the half just played, so running dry plays silence
+void DMA1_Channel2_IRQHandler(void) {
+
+    uint32_t isr = DMA1->ISR;
+    DMA1->IFCR = DMA_IFCR_CGIF2;
+
+    if (isr & DMA_ISR_HTIF2)
+        memset(sample_buf, 0, SAMPLE_HALF);
+
+    if (isr & DMA_ISR_TCIF2) {
+        memset(sample_buf + SAMPLE_HALF, 0, SAMPLE_HALF);
+        sample_laps++;
+    }
+}
+#endif
+
+
+// -----------------------------------------------------------------------------
+// Audio FIFO pacing
+// -----------------------------------------------------------------------------
+void fpga_stream_reset(void) {
+#if FPGA_SAMPLE_DMA
+    sample_dma_start();
+#endif
+    stream_sent = 0;
+    stream_base = audio_tick_count;
+    stream_dry = 0;
+}
+
+uint32_t fpga_stream_underruns(void) {
+    return stream_underruns;
+}
+
+static uint32_t fpga_fifo_free(void) {
+#if FPGA_SAMPLE_DMA
+    uint32_t played = sample_read();
+
+    // Ran dry: the DMA is playing silence. Resume a few bytes ahead of
+    // it, on a word boundary (the buffer index parity is the word phase).
+    if ((int32_t)(played - stream_sent) > 0) {
+        stream_sent = (played + 8) & ~1u;
+        if (stream_sent && !stream_dry)
+            stream_underruns++;
+        stream_dry = 1;
+    }
+    if ((int32_t)(stream_sent - played) >= SAMPLE_AHEAD)
+        return 0;
+    return SAMPLE_AHEAD - (stream_sent - played);
+#else
+    uint32_t played = audio_tick_count - stream_base;
+
+    // Ran dry: the FPGA stopped taking words at the last one sent
+    if (played > stream_sent) {
+        if (stream_sent && !stream_dry)
+            stream_underruns++;
+        stream_dry = 1;
+        stream_base += played - stream_sent;
+        played = stream_sent;
+    }
+    return FPGA_FIFO_BYTES - (stream_sent - played);
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// f_forward() callback: len == 0 asks whether the link can take data,
+// otherwise send as much of buf as the FIFO has room for (whole words,
+// the receiver drops a half word at CS high) and return the count. With
+// DMA the link is busy, and takes nothing, until the last burst is out.
+// -----------------------------------------------------------------------------
+unsigned int fpga_stream(const uint8_t *buf, unsigned int len) {
+#if FPGA_USE_DMA && !FPGA_SAMPLE_DMA
+    if (spi1_dma_busy())
+        return 0;
+#endif
+
+    uint32_t room = fpga_fifo_free() & ~1u;
+
+    if (len == 0)
+        return room != 0;
+
+    if (len > room)
+        len = room;
+    if (len == 0)
+        return 0;
+
+#if FPGA_SAMPLE_DMA
+    // Into the sample buffer at the write position, wrapping
+    uint32_t pos = stream_sent % FPGA_SAMPLE_BUF_BYTES;
+    uint32_t n = FPGA_SAMPLE_BUF_BYTES - pos;
+    if (n > len)
+        n = len;
+    memcpy(sample_buf + pos, buf, n);
+    memcpy(sample_buf, buf + n, len - n);
+#elif FPGA_USE_DMA
+    spi1_dma_start(buf, (uint16_t)len, GPIO_ODR_OD2, 0);
+#else
+    send_spi_data(buf, len, GPIO_ODR_OD2);
+#endif
+    stream_sent += len;
+    stream_dry = 0;
+    return len;
 }
@@ -3,7 +3,58 @@
 
 #include <stdint.h>
 
+// FPGA audio FIFO (async_fifo): 256 16-bit words
+#define FPGA_FIFO_BYTES 512
+
+// Send audio with SPI1 TX DMA (0 = polled send_spi_data())
+#ifndef FPGA_USE_DMA
+#define FPGA_USE_DMA 1
+#endif
+
+// Per-sample mode: every TIM2 update has DMA1 CH2 (TIM2_UP) move one
+// byte from a circular buffer into SPI1, so the link runs at exactly the
+// sample rate (one word per two ticks, as the FPGA reads them) with no
+// CPU per sample and the FPGA FIFO never holds more than a word. Audio
+// CS stays low; other transfers are slotted in between two samples, or
+// dropped at rates whose ticks are too short to fit them.
+// Only half the buffer is filled ahead: the half just played is cleared
+// to silence, so an underrun is quiet rather than a replay.
+#ifndef FPGA_SAMPLE_DMA
+#define FPGA_SAMPLE_DMA 0
+#endif
+
+#ifndef FPGA_SAMPLE_BUF_BYTES
+#define FPGA_SAMPLE_BUF_BYTES 2048
+#endif
+
+// SPI1 DMA events, passed to the notify callback (HALF from the IRQ,
+// the others from spi1_dma_busy()/spi1_dma_wait())
+#define SPI1_DMA_HALF   0   // first half of the buffer sent, reusable
+#define SPI1_DMA_DONE   1   // all sent, CS released
+#define SPI1_DMA_ERROR  2
+
+// SPI1 is transmit-only (bidirectional mode, output enabled): nothing is
+// received, so neither path drains RX
 void initSPI1_FPGA(void);
-void send_spi_data(uint8_t *buf, uint16_t len, uint32_t cs_pin_mask);
+void send_spi_data(const uint8_t *buf, uint16_t len, uint32_t cs_pin_mask);
+
+// SPI1 TX DMA (DMA1 CH3): CS low at start, high once the last byte is
+// off the wire, which spi1_dma_busy() (polled from the main loop) or
+// spi1_dma_wait() notices. buf must stay untouched until the transfer
+// is done.
+void initSPI1_DMA(void);
+int spi1_dma_start(const uint8_t *buf, uint16_t len, uint32_t cs_pin_mask,
+                   void (*notify)(uint8_t event));
+int spi1_dma_busy(void);
+int spi1_dma_wait(void);
+
+// f_forward() sink for the audio link, paced by the FPGA FIFO fill. With
+// FPGA_USE_DMA the data handed over is still being read until the link
+// reports ready again (or spi1_dma_wait()). With FPGA_SAMPLE_DMA it is
+// copied into the sample buffer and paced by the DMA position;
+// fpga_stream_reset() starts the sample DMA.
+void fpga_stream_reset(void);
+unsigned int fpga_stream(const uint8_t *buf, unsigned int len);
+uint32_t fpga_stream_underruns(void);
 
 #endif
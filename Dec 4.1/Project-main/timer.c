@@ -1,15 +1,20 @@
 #include "timer.h"
 #include "main.h"
+#include "spi_fpga.h"
 #include "stm32l432xx.h"
 
 // These globals live in main.c, but are declared in main.h
 extern volatile uint16_t f_read_counter;
 extern volatile int f_read_ready_flag;
 extern volatile uint16_t adc_counter;
+extern volatile uint32_t audio_tick_count;
 
 extern uint8_t scale_1p5_and_clamp(uint8_t v);
 extern uint8_t Read_ADC_Channel(uint8_t channel);
 
+// ARR for the open track's rate at normal speed (832: 48 kHz at 80 MHz)
+static volatile uint32_t tim2_base_arr = 832;
+
 
 // -----------------------------------------------------------------------------
 // TIM2 Initialization (Default)
@@ -18,9 +23,13 @@ void TIM2_Init_Default(void) {
     RCC->APB1ENR1 |= RCC_APB1ENR1_TIM2EN;
 
     TIM2->PSC = 0;
-    TIM2->ARR = 832;                 // Initial ARR
+    TIM2->ARR = tim2_base_arr;       // Initial ARR
+    TIM2->CR1 |= TIM_CR1_ARPE;       // Later ARR writes take effect at the next update
 
     TIM2->DIER |= TIM_DIER_UIE;      // Update interrupt enable
+#if FPGA_SAMPLE_DMA
+    TIM2->DIER |= TIM_DIER_UDE;      // Update DMA request: one audio byte per tick
+#endif
 
     NVIC_SetPriority(TIM2_IRQn, 2);
     NVIC_EnableIRQ(TIM2_IRQn);
@@ -29,6 +38,39 @@ void TIM2_Init_Default(void) {
 }
 
 
+// -----------------------------------------------------------------------------
+// TIM2 rate for a track: PB0 toggles every update and the FPGA takes a
+// sample per rising edge, two updates per sample. Taken over at the next
+// update (ARR is preloaded, so a count already past the new ARR does not
+// run on to the 32-bit wrap); the speed pot rescales it on its next
+// reading. May be called before TIM2_Init_Default(), which starts at
+// this rate.
+// -----------------------------------------------------------------------------
+void TIM2_SetSampleRate(uint32_t hz) {
+    tim2_base_arr = SystemCoreClock / (2 * hz) - 1;
+    TIM2->ARR = tim2_base_arr;
+}
+
+
+// -----------------------------------------------------------------------------
+// DWT cycle counter
+// Started once and never reset, so DWT_Now() is also time since boot.
+// Wraps after ~53 s at 80 MHz; intervals are unsigned differences.
+// -----------------------------------------------------------------------------
+void DWT_Init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t DWT_Now(void) {
+    return DWT->CYCCNT;
+}
+
+uint32_t DWT_ElapsedUs(uint32_t start) {
+    return (DWT->CYCCNT - start) / (SystemCoreClock / 1000000);
+}
+
+
 // -----------------------------------------------------------------------------
 // TIM2 Interrupt Handler
 // -----------------------------------------------------------------------------
@@ -39,6 +81,7 @@ void TIM2_IRQHandler(void) {
 
         // Toggle PB0 (square wave)
         GPIOB->ODR ^= GPIO_ODR_OD0;
+        audio_tick_count++;
 
         // WAV buffer counter
         f_read_counter++;
@@ -61,7 +104,9 @@ void TIM2_IRQHandler(void) {
             if (new_arr < 855 && new_arr > 811)
                 new_arr = 832;
 
-            TIM2->ARR = new_arr;
+            // Same speed ratio around the track's own rate, from the
+            // next update (preloaded)
+            TIM2->ARR = new_arr * tim2_base_arr / 832;
         }
     }
 }
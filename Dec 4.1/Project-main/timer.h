@@ -5,4 +5,13 @@
 
 void TIM2_Init_Default(void);
 
+// Sample clock for a track's native rate (two ticks per sample); the
+// speed pot scales around it
+void TIM2_SetSampleRate(uint32_t hz);
+
+// DWT cycle counter: free-running core-clock timestamps
+void DWT_Init(void);
+uint32_t DWT_Now(void);
+uint32_t DWT_ElapsedUs(uint32_t start);
+
 #endif
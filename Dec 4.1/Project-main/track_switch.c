@@ -0,0 +1,39 @@
+#include "track_switch.h"
+#include "timer.h"
+#include "audio_ring.h"
+#include "pcm_convert.h"
+
+static WAV_Format next_format;
+static uint8_t switch_pending = 0;
+static UINT switch_hold = 0;
+
+void track_opened(UINT queued) {
+    next_format = *wav_format();
+
+    printf("Track %ld: %lu Hz, %u ch, %u bit%s, %lu bytes\n", (long)current_track_index,
+           (unsigned long)next_format.sample_rate, next_format.channels, next_format.bits,
+           (next_format.format_tag == WAV_FORMAT_FLOAT) ? " float" : "",
+           (unsigned long)next_format.data_length);
+
+    switch_pending = 1;
+    switch_hold = queued;
+    track_sent(0);
+}
+
+UINT track_hold(void) {
+    return switch_pending ? switch_hold : AUDIO_RING_ALL;
+}
+
+void track_sent(UINT sent) {
+    if (!switch_pending)
+        return;
+
+    switch_hold = (sent < switch_hold) ? switch_hold - sent : 0;
+    if (switch_hold == 0) {
+        TIM2_SetSampleRate(next_format.sample_rate);
+#if PCM_CONVERT
+        pcm_set_format(&next_format);
+#endif
+        switch_pending = 0;
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef TRACK_SWITCH_H
+#define TRACK_SWITCH_H
+
+#include "wav.h"
+
+// Sample clock and input format for the open track. In ring mode the
+// previous track's bytes not yet handed to the sink at the open
+// (audio_ring_unsent()) go out first, at its own rate and through its own
+// conversion; the drain stops at the last of them (track_hold()), so both
+// switch at the new track's first byte. With queued 0 they switch at once.
+void track_opened(UINT queued);
+
+// Bytes the sink may take before the switch, AUDIO_RING_ALL once done;
+// track_sent() counts what it took
+UINT track_hold(void);
+void track_sent(UINT sent);
+
+#endif
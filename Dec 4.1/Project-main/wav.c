@@ -1,66 +1,913 @@
 #include "wav.h"
+#include "pcm_convert.h"
+#include "SD_lowlevel.h"
 #include <string.h>
 
 // These globals are declared in main.h, defined in main.c:
 extern FATFS FatFs;
 extern FIL file;
-extern FRESULT fres;
 
-extern BYTE audio_buffer[512];
-extern UINT bytesRead;
+// Track table: one compact record per playable file. RAM holds records
+// [window_base, window_base + window_count) of the full table.
+WAV_Track wav_tracks[WAV_MAX_TRACKS];
+DWORD wav_track_count = 0;
+int32_t current_track_index = -1;
 
-extern char wav_files[MAX_WAV_FILES][32];
-extern uint8_t wav_file_count;
-extern int8_t current_file_index;
+static DWORD window_base = 0;
+static DWORD window_count = 0;
+
+// Index file, reopened by cluster to refill the window
+static DWORD index_clust = 0;
+static FSIZE_t index_size = 0;
+static BYTE index_stat;
+
+// Playlist mode: file location and offset of the next entry
+static uint8_t playlist_mode = 0;
+static DWORD playlist_clust;
+static FSIZE_t playlist_size;
+static BYTE playlist_stat;
+static FSIZE_t playlist_pos;
+
+// Path buffer shared by the scanner and the playlist reader
+static TCHAR wav_path[WAV_PATH_MAX];
+
+// Record of the open track
+static WAV_Track current_track;
+
+// Cluster link map of the open track (one track is open at a time)
+static DWORD clmt[WAV_CLMT_ENTRIES];
+
+// Offset of the first audio byte in the open track, and its format
+static FSIZE_t data_start = 44;
+static WAV_Format track_format;
+
+// Contiguous track: first LBA and read position, f_read is bypassed
+static uint8_t raw_mode = 0;
+static LBA_t raw_lba;
+static FSIZE_t raw_pos;
+
+// wav_read_start() request: its length, and whether it is still with
+// the card (raw mode only) or was read synchronously; what was submitted,
+// to read it again
+static UINT async_len = 0;
+static uint8_t async_busy = 0;
+static LBA_t async_lba;
+static BYTE* async_buf;
+static UINT async_count;
+
+
+// -----------------------------------------------------------------------------
+// Open a file from its start cluster and size: the same state f_open()
+// leaves for a read-only file, so no path is resolved. stat is the exFAT
+// allocation status (2: NoFatChain, clusters contiguous), 0 on FAT.
+// -----------------------------------------------------------------------------
+static int open_cluster(DWORD sclust, FSIZE_t size, BYTE stat) {
+    if (sclust < 2 || sclust >= FatFs.n_fatent)
+        return -1;
+
+    memset(&file, 0, sizeof(file));
+    file.obj.fs = &FatFs;
+    file.obj.id = FatFs.id;
+    file.obj.attr = AM_ARC;
+    file.obj.sclust = sclust;
+    file.obj.objsize = size;
+#if FF_FS_EXFAT
+    file.obj.stat = stat;
+#else
+    (void)stat;
+#endif
+    file.flag = FA_READ;
+    return 0;
+}
+
+static WORD le16(const BYTE* p) {
+    return (WORD)(p[0] | (p[1] << 8));
+}
+
+static DWORD le32(const BYTE* p) {
+    return p[0] | (p[1] << 8) | ((DWORD)p[2] << 16) | ((DWORD)p[3] << 24);
+}
+
+static BYTE file_stat(const FIL* fp) {
+#if FF_FS_EXFAT
+    return fp->obj.stat;
+#else
+    (void)fp;
+    return 0;
+#endif
+}
+
+
+// -----------------------------------------------------------------------------
+// Start cluster of the item f_readdir() just returned, taken from its SFN
+// entry while that is still in the FatFs window. dir_next() has already
+// stepped past it; 0 if the entry is no longer there (end of directory,
+// or the step crossed a cluster and loaded a FAT sector).
+// On exFAT the whole entry set is still in FatFs.dirbuf; its stream
+// extension entry also carries the NoFatChain flag.
+// -----------------------------------------------------------------------------
+static DWORD readdir_cluster(const DIR* dp, const FILINFO* fno, BYTE* stat) {
+    *stat = 0;
+
+#if FF_FS_EXFAT
+    if (FatFs.fs_type == FS_EXFAT) {
+        const BYTE* xd = FatFs.dirbuf;
+        QWORD size = 0;
+        for (int i = 7; i >= 0; i--)
+            size = (size << 8) | xd[56 + i];        // XDIR_FileSize
+        if (size != fno->fsize)
+            return 0;
+
+        *stat = xd[33] & 2;                         // XDIR_GenFlags
+        return xd[52] | (xd[53] << 8) | ((DWORD)xd[54] << 16) | ((DWORD)xd[55] << 24);
+    }
+#endif
+
+    if (dp->sect == 0)
+        return 0;
+
+    LBA_t sect = (dp->dptr % 512) ? dp->sect : dp->sect - 1;
+    if (FatFs.winsect != sect)
+        return 0;
+
+    // Entry must be the one described by fno
+    const BYTE* ent = FatFs.win + (dp->dptr - 32) % 512;
+    DWORD size = ent[28] | (ent[29] << 8) | ((DWORD)ent[30] << 16) | ((DWORD)ent[31] << 24);
+    WORD  time = ent[22] | (ent[23] << 8);
+    WORD  date = ent[24] | (ent[25] << 8);
+    if (size != fno->fsize || time != fno->ftime || date != fno->fdate)
+        return 0;
+
+    return ((DWORD)(ent[20] | (ent[21] << 8)) << 16) | (ent[26] | (ent[27] << 8));
+}
+
+// Fallback: resolve the path once
+static DWORD lookup_cluster(const TCHAR* path, BYTE* stat) {
+    FIL f;
+    DWORD clst = 0;
+
+    if (f_open(&f, path, FA_READ) == FR_OK) {
+        clst = f.obj.sclust;
+        *stat = file_stat(&f);
+        f_close(&f);
+    }
+    return clst;
+}
+
+// Append "/name" to wav_path; 0 if it does not fit
+static UINT path_join(UINT len, const TCHAR* name) {
+    UINT n = strlen(name);
+
+    if (len > 0 && wav_path[len - 1] != '/') {
+        if (len + 1 >= WAV_PATH_MAX)
+            return 0;
+        wav_path[len++] = '/';
+    }
+    if (len + n >= WAV_PATH_MAX)
+        return 0;
+
+    memcpy(wav_path + len, name, n + 1);
+    return len + n;
+}
+
+static int is_wav_name(const TCHAR* name) {
+    const char *ext = strrchr(name, '.');
+    return ext && strcasecmp(ext, ".WAV") == 0;
+}
+
+
+// -----------------------------------------------------------------------------
+// Volume stamp for the track index
+// f_getlabel() without a label buffer only reads the VBR for the serial.
+// Without valid FSInfo (FAT12/16, or FAT32 after an unclean unmount) the
+// free count is computed with f_getfree(), a FAT scan.
+// -----------------------------------------------------------------------------
+#if FF_FS_READONLY
+// A read-only FatFs neither loads FSInfo nor has f_getfree(): read FSInfo
+// into the window the way f_mount() would (f_getlabel() left the VBR
+// there). A volume without a valid one cannot be stamped; it is scanned.
+static int fsinfo_stamp(WAV_IndexHeader* h) {
+    BYTE* w = FatFs.win;
+
+    if (FatFs.fs_type != FS_FAT32 || FatFs.winsect != FatFs.volbase ||
+        (w[48] | (w[49] << 8)) != 1)
+        return -1;
+
+    FatFs.winsect = (LBA_t)0 - 1;
+    if (disk_read(0, w, FatFs.volbase + 1, 1) != RES_OK)
+        return -1;
+    FatFs.winsect = FatFs.volbase + 1;
+
+    if (le32(w) != 0x41615252 || le32(w + 484) != 0x61417272 ||
+        le32(w + 508) != 0xAA550000 || le32(w + 488) > FatFs.n_fatent - 2)
+        return -1;
+
+    h->free_clst = le32(w + 488);
+    h->last_clst = le32(w + 492);
+    return 0;
+}
+#endif
+
+static int volume_stamp(WAV_IndexHeader* h) {
+    FILINFO fno;
+
+    if (f_getlabel("", 0, &h->vsn) != FR_OK)
+        return -1;
+
+#if FF_FS_READONLY
+    if (fsinfo_stamp(h) != 0)
+        return -1;
+#else
+    if (FatFs.free_clst > FatFs.n_fatent - 2) {
+        DWORD nclst;
+        FATFS* fs;
+        if (f_getfree("", &nclst, &fs) != FR_OK)
+            return -1;
+    }
+    h->free_clst = FatFs.free_clst;
+
+    // The next-free hint only survives a remount through working FSInfo
+    h->last_clst = (FatFs.fs_type == FS_FAT32 && !(FatFs.fsi_flag & 0x80)) ? FatFs.last_clst : 0;
+#endif
+
+    h->dir_time = 0;
+    if (WAV_LIBRARY_DIR[1] != 0) {
+        if (f_stat(WAV_LIBRARY_DIR, &fno) != FR_OK)
+            return -1;
+        h->dir_time = ((DWORD)fno.fdate << 16) | fno.ftime;
+    }
+    return 0;
+}
 
 
 // -----------------------------------------------------------------------------
-// Scan SD card root directory for .WAV files
+// Scan the library directory and its subdirectories for .WAV files
+// Directories are walked with a stack of WAV_SCAN_DEPTH + 1 DIR objects;
+// deeper levels, hidden/system folders and over-long paths are skipped.
+// Each track is recorded by start cluster and length, not by name, and
+// streamed into a fresh on-card index as it is found, so the library is
+// not limited by RAM. RAM keeps the first WAV_MAX_TRACKS; without an
+// index (write failure, read-only build) that is the whole library.
 // -----------------------------------------------------------------------------
 void scan_wav_files(void) {
-    DIR dir;
+    static DIR dirs[WAV_SCAN_DEPTH + 1];
+    WORD path_len[WAV_SCAN_DEPTH + 1];
     FILINFO fno;
+    int depth = 0;
+    uint8_t indexing = 0;
+
+    wav_track_count = 0;
+    window_base = window_count = 0;
+    index_clust = 0;
+    playlist_mode = 0;
+
+    // Directory sectors are worth caching
+    disk_cache_bypass_from(0);
+
+#if !FF_FS_READONLY
+    WAV_IndexHeader h = {0};
+    UINT bw;
+
+    // Header with magic 0 until the scan is complete
+    if (f_open(&file, WAV_INDEX_FILE, FA_WRITE | FA_CREATE_ALWAYS) == FR_OK) {
+        indexing = (f_write(&file, &h, sizeof(h), &bw) == FR_OK && bw == sizeof(h));
+        if (!indexing)
+            f_close(&file);
+    }
+#endif
+
+    path_len[0] = path_join(0, WAV_LIBRARY_DIR);
+    if (f_opendir(&dirs[0], wav_path) != FR_OK)
+        depth = -1;
+
+    while (depth >= 0) {
+        if (f_readdir(&dirs[depth], &fno) != FR_OK || fno.fname[0] == 0) {
+            f_closedir(&dirs[depth--]);
+            continue;
+        }
+
+        if (fno.fattrib & AM_DIR) {
+            if (depth == WAV_SCAN_DEPTH || fno.fname[0] == '.' || (fno.fattrib & (AM_HID | AM_SYS)))
+                continue;
 
-    wav_file_count = 0;
+            UINT len = path_join(path_len[depth], fno.fname);
+            if (len && f_opendir(&dirs[depth + 1], wav_path) == FR_OK)
+                path_len[++depth] = len;
+            continue;
+        }
+
+        if (!is_wav_name(fno.fname) || fno.fsize <= 44 || fno.fsize > 0xFFFFFFFF)
+            continue;
+
+        BYTE stat;
+        DWORD clst = readdir_cluster(&dirs[depth], &fno, &stat);
+        if (clst == 0 && path_join(path_len[depth], fno.fname))
+            clst = lookup_cluster(wav_path, &stat);
+        if (clst < 2)
+            continue;
+
+        WAV_Track t;
+        t.sclust = clst;
+        t.size = (DWORD)fno.fsize;
+        t.flags = (stat == 2) ? WAV_TRACK_NOFATCHAIN : 0;
+        memset(t.reserved, 0, sizeof(t.reserved));
+
+        if (wav_track_count < WAV_MAX_TRACKS)
+            wav_tracks[window_count++] = t;
+
+#if !FF_FS_READONLY
+        if (indexing && (f_write(&file, &t, sizeof(t), &bw) != FR_OK || bw != sizeof(t))) {
+            f_close(&file);
+            indexing = 0;
+        }
+#endif
+
+        if (indexing || wav_track_count < WAV_MAX_TRACKS)
+            wav_track_count++;
+    }
 
-    if (f_opendir(&dir, "/") != FR_OK)
+#if !FF_FS_READONLY
+    // No index to window onto (the write failed partway): RAM holds all
+    if (!indexing) {
+        if (wav_track_count > WAV_MAX_TRACKS)
+            wav_track_count = WAV_MAX_TRACKS;
         return;
+    }
+
+    // Stamp after the index's own allocation, then commit the header
+    h.magic = WAV_INDEX_MAGIC;
+    h.version = WAV_INDEX_VERSION;
+    h.record_size = sizeof(WAV_Track);
+    h.count = wav_track_count;
+
+    FRESULT res = f_sync(&file);
+    if (res == FR_OK)
+        res = (volume_stamp(&h) == 0) ? FR_OK : FR_DISK_ERR;
+    if (res == FR_OK)
+        res = f_lseek(&file, 0);
+    if (res == FR_OK)
+        res = f_write(&file, &h, sizeof(h), &bw);
+
+    DWORD clst = file.obj.sclust;
+    FSIZE_t size = file.obj.objsize;
+    BYTE stat = file_stat(&file);
+    if (f_close(&file) == FR_OK && res == FR_OK) {
+        index_clust = clst;
+        index_size = size;
+        index_stat = stat;
+    } else if (wav_track_count > WAV_MAX_TRACKS) {
+        wav_track_count = WAV_MAX_TRACKS;
+    }
+#endif
+}
+
+
+// -----------------------------------------------------------------------------
+// Load the track table from the on-card index: one read for the header,
+// one for the first window of records
+// Returns -1 when there is no index or it is stale; scan then
+// -----------------------------------------------------------------------------
+int load_track_index(void) {
+    WAV_IndexHeader h, now;
+    UINT br;
+    int res = -1;
+
+    disk_cache_bypass_from(0);
+    playlist_mode = 0;
+    wav_track_count = window_count = window_base = 0;
+    index_clust = 0;
+
+    if (volume_stamp(&now) != 0)
+        return -1;
+
+    if (f_open(&file, WAV_INDEX_FILE, FA_READ) != FR_OK)
+        return -1;
+
+    if (f_read(&file, &h, sizeof(h), &br) == FR_OK && br == sizeof(h) &&
+        h.magic == WAV_INDEX_MAGIC && h.version == WAV_INDEX_VERSION &&
+        h.record_size == sizeof(WAV_Track) &&
+        f_size(&file) == sizeof(h) + (FSIZE_t)h.count * sizeof(WAV_Track) &&
+        h.vsn == now.vsn && h.free_clst == now.free_clst &&
+        h.last_clst == now.last_clst && h.dir_time == now.dir_time) {
+
+        DWORD n = (h.count < WAV_MAX_TRACKS) ? h.count : WAV_MAX_TRACKS;
+        UINT len = n * sizeof(WAV_Track);
+        if (f_read(&file, wav_tracks, len, &br) == FR_OK && br == len) {
+            wav_track_count = h.count;
+            window_count = n;
+            index_clust = file.obj.sclust;
+            index_size = f_size(&file);
+            index_stat = file_stat(&file);
+            res = 0;
+        }
+    }
+
+    f_close(&file);
+    return res;
+}
+
+
+// -----------------------------------------------------------------------------
+// Record i of the track table, refilling the RAM window from the index
+// (reopened by cluster) when i is outside it
+// -----------------------------------------------------------------------------
+static int fetch_track(DWORD i, WAV_Track* t) {
+    UINT br;
+
+    if (i - window_base >= window_count) {
+        if (index_clust == 0 || i >= wav_track_count ||
+            open_cluster(index_clust, index_size, index_stat) != 0)
+            return -1;
+
+        DWORD n = wav_track_count - i;
+        if (n > WAV_MAX_TRACKS) n = WAV_MAX_TRACKS;
+        UINT len = n * sizeof(WAV_Track);
+
+        window_count = 0;
+        if (f_lseek(&file, sizeof(WAV_IndexHeader) + (FSIZE_t)i * sizeof(WAV_Track)) != FR_OK ||
+            f_read(&file, wav_tracks, len, &br) != FR_OK || br != len)
+            return -1;
+
+        window_base = i;
+        window_count = n;
+    }
+
+    *t = wav_tracks[i - window_base];
+    return 0;
+}
+
+
+// -----------------------------------------------------------------------------
+// Playlist
+// The playlist is never loaded: each track change reopens it by cluster,
+// seeks to the saved offset and reads one line, so RAM use does not
+// depend on the number of entries.
+// -----------------------------------------------------------------------------
+int open_playlist(void) {
+    playlist_mode = 0;
+
+    disk_cache_bypass_from(0);
+    if (f_open(&file, WAV_PLAYLIST, FA_READ) != FR_OK)
+        return -1;
+
+    playlist_clust = file.obj.sclust;
+    playlist_size = f_size(&file);
+    playlist_stat = file_stat(&file);
+    playlist_pos = 0;
+    f_close(&file);
+
+    if (playlist_clust == 0)
+        return -1;
+
+    playlist_mode = 1;
+    current_track_index = -1;
+    return 0;
+}
+
+// Next entry path into wav_path, resolved against the playlist's
+// directory; 0 at the end of the playlist
+static int playlist_next_entry(void) {
+    static const TCHAR dir[] = WAV_PLAYLIST;
+    UINT dir_len = strrchr(dir, '/') - dir + 1;
+    BYTE chunk[32];
+    UINT br, len = 0;
+    int skip = 0;       // comment or over-long line
+
+    if (open_cluster(playlist_clust, playlist_size, playlist_stat) != 0 ||
+        f_lseek(&file, playlist_pos) != FR_OK)
+        return 0;
 
     for (;;) {
-        if (f_readdir(&dir, &fno) != FR_OK || fno.fname[0] == 0)
-            break;
+        if (f_read(&file, chunk, sizeof(chunk), &br) != FR_OK || br == 0) {
+            br = 0;
+            if (len == 0 && playlist_pos >= playlist_size)
+                return 0;
+        }
 
-        if (!(fno.fattrib & AM_DIR)) {
-            char *ext = strrchr(fno.fname, '.');
-            if (ext && (strcasecmp(ext, ".WAV") == 0)) {
-                if (wav_file_count < MAX_WAV_FILES) {
-                    strcpy(wav_files[wav_file_count], fno.fname);
-                    wav_file_count++;
+        UINT i;
+        for (i = 0; i < br && chunk[i] != '\n'; i++) {
+            TCHAR c = chunk[i];
+            if (len == 0 && !skip) {
+                if (c == '#')
+                    skip = 1;
+                if (c == ' ' || c == '\t' || c == '\r')
+                    continue;
+                // Relative entry: start from the playlist's directory
+                if (!skip && c != '/') {
+                    memcpy(wav_path, dir, dir_len);
+                    len = dir_len;
                 }
             }
+            if (skip || c == '\r')
+                continue;
+            if (c == '\\')
+                c = '/';
+            if (len + 1 < WAV_PATH_MAX)
+                wav_path[len++] = c;
+            else
+                skip = 1;
+        }
+        playlist_pos += (i < br) ? i + 1 : br;
+
+        // End of line, or end of file
+        if (i < br || br == 0) {
+            if (!skip && len > 0) {
+                while (len > 0 && (wav_path[len - 1] == ' ' || wav_path[len - 1] == '\t'))
+                    len--;
+                wav_path[len] = 0;
+                return 1;
+            }
+            if (br == 0 || f_lseek(&file, playlist_pos) != FR_OK)
+                return 0;
+            len = 0;
+            skip = 0;
+        }
+    }
+}
+
+// Open the next playable playlist entry, wrapping once at the end
+static int open_playlist_track(WAV_Track* t) {
+    int wrapped = 0;
+
+    for (;;) {
+        if (!playlist_next_entry()) {
+            if (wrapped++)
+                return -1;
+            playlist_pos = 0;
+            continue;
+        }
+
+        if (!is_wav_name(wav_path) || f_open(&file, wav_path, FA_READ) != FR_OK)
+            continue;
+
+        if (f_size(&file) > 44 && f_size(&file) <= 0xFFFFFFFF && file.obj.sclust >= 2) {
+            t->sclust = file.obj.sclust;
+            t->size = (DWORD)f_size(&file);
+            t->flags = (file_stat(&file) == 2) ? WAV_TRACK_NOFATCHAIN : 0;
+            memset(t->reserved, 0, sizeof(t->reserved));
+            current_track_index++;
+            return 0;
         }
+        f_close(&file);
     }
+}
+
 
-    f_closedir(&dir);
+// A request still with the card completes into a buffer about to be
+// reused: finish it and drop the data
+static void read_cancel(void) {
+    if (async_busy)
+        SD_AsyncWait();
+    async_busy = 0;
+    async_len = 0;
 }
 
 
 // -----------------------------------------------------------------------------
-// Open next WAV file in the file list
-// Reads header (44 bytes) and positions file for streaming
+// RIFF/WAVE header of the open file
+// One WAV_HEADER_READ-byte read of the file start holds the chunk walk for
+// a plain or extensible header; a chunk header past the bytes in hand
+// (a large LIST chunk) is fetched with one more read at its offset. Fills
+// the format and the offset of the data chunk; 0 if both were found and
+// the format is one this player knows.
 // -----------------------------------------------------------------------------
-int open_next_wav_file(void) {
-    if (wav_file_count == 0)
+static int header_read(BYTE* buf, FSIZE_t pos, UINT* br) {
+    if (f_lseek(&file, pos) != FR_OK || f_read(&file, buf, WAV_HEADER_READ, br) != FR_OK)
+        return -1;
+    return 0;
+}
+
+static int parse_fmt(const BYTE* p, DWORD size, WAV_Format* fmt) {
+    fmt->format_tag = le16(p);
+    fmt->channels = le16(p + 2);
+    fmt->sample_rate = le32(p + 4);
+    fmt->block_align = le16(p + 12);
+    fmt->bits = le16(p + 14);
+
+    // WAVE_FORMAT_EXTENSIBLE: the real tag leads the subformat GUID
+    if (fmt->format_tag == WAV_FORMAT_EXTENSIBLE) {
+        if (size < 40)
+            return -1;
+        fmt->format_tag = le16(p + 24);
+    }
+
+    if (fmt->format_tag != WAV_FORMAT_PCM && fmt->format_tag != WAV_FORMAT_FLOAT)
         return -1;
+    if (fmt->channels == 0 || fmt->bits == 0 || fmt->bits % 8 || fmt->bits > 32 ||
+        fmt->block_align != fmt->channels * (fmt->bits / 8) ||
+        fmt->sample_rate < WAV_RATE_MIN || fmt->sample_rate > WAV_RATE_MAX)
+        return -1;
+    return 0;
+}
 
-    current_file_index = (current_file_index + 1) % wav_file_count;
+static int parse_header(WAV_Format* fmt, FSIZE_t* data_ofs) {
+    BYTE h[WAV_HEADER_READ];
+    FSIZE_t base = 0, pos = 12;
+    UINT br;
+    int have_fmt = 0;
 
-    FRESULT result = f_open(&file, wav_files[current_file_index], FA_READ);
-    if (result != FR_OK)
+    if (header_read(h, 0, &br) != 0 || br < 12 ||
+        memcmp(h, "RIFF", 4) != 0 || memcmp(h + 8, "WAVE", 4) != 0)
         return -1;
 
-    // Skip the WAV header (44 bytes)
-    f_read(&file, audio_buffer, 44, &bytesRead);
+    for (int n = 0; n < WAV_MAX_CHUNKS; n++) {
+        if (pos + 8 > f_size(&file))
+            return -1;
+        if (pos + 8 > base + br) {
+            if (header_read(h, pos, &br) != 0 || br < 8)
+                return -1;
+            base = pos;
+        }
+
+        const BYTE* c = h + (UINT)(pos - base);
+        DWORD size = le32(c + 4);
+
+        if (memcmp(c, "fmt ", 4) == 0) {
+            // The fields used sit in the first 40 bytes (extensible)
+            UINT want = 8 + ((size < 40) ? (UINT)size : 40);
+            if (pos + want > base + br) {
+                if (header_read(h, pos, &br) != 0 || br < want)
+                    return -1;
+                base = pos;
+                c = h;
+            }
+            if (size < 16 || parse_fmt(c + 8, size, fmt) != 0)
+                return -1;
+            have_fmt = 1;
+        } else if (memcmp(c, "data", 4) == 0) {
+            if (!have_fmt)
+                return -1;
+
+            // A data size past the end (a truncated recording, or a
+            // streaming writer's 0xFFFFFFFF) plays what is there
+            FSIZE_t avail = f_size(&file) - (pos + 8);
+            *data_ofs = pos + 8;
+            fmt->data_length = (size < avail) ? size : (DWORD)avail;
+            fmt->data_length -= fmt->data_length % fmt->block_align;
+            return 0;
+        }
+
+        // Chunks are padded to an even length
+        pos += 8 + (FSIZE_t)size + (size & 1);
+    }
+    return -1;
+}
+
+// The FPGA link carries 16-bit mono PCM; pcm_convert.c makes it from
+// the other common formats
+static int wav_playable(const WAV_Format* fmt) {
+    return pcm_supported(fmt) && fmt->data_length != 0;
+}
+
+
+// -----------------------------------------------------------------------------
+// Open one track (library or playlist), parse its header and position it
+// at its first sample. 1 if it is not a file the link can play.
+// -----------------------------------------------------------------------------
+static int open_track(void) {
+    WAV_Track t;
+
+    if (playlist_mode) {
+        if (open_playlist_track(&t) != 0)
+            return -1;
+    } else {
+        current_track_index = (current_track_index + 1) % wav_track_count;
+        if (fetch_track(current_track_index, &t) != 0 ||
+            open_cluster(t.sclust, t.size, (t.flags & WAV_TRACK_NOFATCHAIN) ? 2 : 0) != 0)
+            return -1;
+    }
+    current_track = t;
+
+    // Map the cluster chain once so seeks and cluster boundaries in
+    // f_read never walk the FAT; too fragmented for the pool: walk it.
+    // An exFAT NoFatChain file is one fragment by definition: its map is
+    // written directly, without visiting a single cluster.
+    file.cltbl = clmt;
+    if (t.flags & WAV_TRACK_NOFATCHAIN) {
+        DWORD bcs = (DWORD)FatFs.csize * 512;
+        clmt[0] = 4;
+        clmt[1] = (DWORD)((f_size(&file) + bcs - 1) / bcs);
+        clmt[2] = file.obj.sclust;
+        clmt[3] = 0;
+    } else {
+        clmt[0] = WAV_CLMT_ENTRIES;
+        if (f_lseek(&file, CREATE_LINKMAP) != FR_OK)
+            file.cltbl = 0;
+    }
+
+    // Locate the audio; chunks after it (LIST, id3) are cut off the end
+    if (parse_header(&track_format, &data_start) != 0 || !wav_playable(&track_format))
+        return 1;
+    file.obj.objsize = data_start + track_format.data_length;
+
+    if (f_lseek(&file, data_start) != FR_OK)
+        return -1;
 
+    // One fragment (table of size, length, top, 0): physically
+    // contiguous, stream it by LBA
+    raw_mode = file.cltbl && clmt[0] == 4;
+    if (raw_mode) {
+        raw_lba = FatFs.database + (LBA_t)FatFs.csize * (file.obj.sclust - 2);
+        raw_pos = data_start;
+    }
     return 0;
 }
+
+// -----------------------------------------------------------------------------
+// Open the next playable track, skipping files with a broken header or a
+// format the link does not carry; one lap of the library (or up to
+// WAV_MAX_TRACKS playlist entries) finding none is an error
+// -----------------------------------------------------------------------------
+int open_next_wav_file(void) {
+    DWORD tries = playlist_mode ? WAV_MAX_TRACKS : wav_track_count;
+    int r = -1;
+
+    read_cancel();
+    raw_mode = 0;
+
+    // Cache directory, index and FAT sectors while the track is located
+    disk_cache_bypass_from(0);
+
+    while (tries--) {
+        r = open_track();
+        if (r <= 0)
+            break;
+        r = -1;
+    }
+
+    // From here on only FAT sectors are cached; audio data bypasses
+    disk_cache_bypass_from(FatFs.database);
+
+    return r;
+}
+
+const WAV_Track* wav_current_track(void) {
+    return &current_track;
+}
+
+const WAV_Format* wav_format(void) {
+    return &track_format;
+}
+
+
+// -----------------------------------------------------------------------------
+// Seek within the audio data of the open track (offset from the first
+// sample, rounded down to a whole frame)
+// -----------------------------------------------------------------------------
+int seek_wav_file(FSIZE_t offset) {
+    FSIZE_t pos = data_start + offset - offset % track_format.block_align;
+
+    read_cancel();
+    if (pos > f_size(&file))
+        pos = f_size(&file);
+
+    if (raw_mode) {
+        raw_pos = pos;
+        return 0;
+    }
+    return (f_lseek(&file, pos) == FR_OK) ? 0 : -1;
+}
+
+
+// -----------------------------------------------------------------------------
+// Read audio data from the open track
+// A read that starts mid-sector (the data start after the header, or a
+// seek) returns only up to the sector boundary, so every later read is
+// whole sectors (given whole-sector btr) and buf must hold 512 bytes.
+// Contiguous tracks are read straight into buf with disk_read, fragmented
+// tracks go through f_read, which also transfers whole sectors directly
+// into buf rather than through the FIL buffer; either is multi-block
+// when btr allows.
+// -----------------------------------------------------------------------------
+FRESULT wav_read(BYTE* buf, UINT btr, UINT* br) {
+    if (!raw_mode) {
+        UINT ofs = (UINT)(f_tell(&file) % 512);
+        if (ofs && btr > 512 - ofs)
+            btr = 512 - ofs;
+        return f_read(&file, buf, btr, br);
+    }
+
+    FSIZE_t remain = f_size(&file) - raw_pos;
+    LBA_t sect = raw_lba + (LBA_t)(raw_pos / 512);
+    UINT ofs = (UINT)(raw_pos % 512);
+    UINT n;
+
+    *br = 0;
+    if (remain == 0)
+        return FR_OK;
+
+    if (ofs || btr < 512 || remain < 512) {
+        // Partial sector: read it whole, keep the wanted part
+        if (disk_read(0, buf, sect, 1) != RES_OK)
+            return FR_DISK_ERR;
+
+        n = 512 - ofs;
+        if (n > btr) n = btr;
+        if (n > remain) n = (UINT)remain;
+        if (ofs)
+            memmove(buf, buf + ofs, n);
+    } else {
+        UINT count = btr / 512;
+        if (count > remain / 512) count = (UINT)(remain / 512);
+
+        if (disk_read(0, buf, sect, count) != RES_OK)
+            return FR_DISK_ERR;
+        n = count * 512;
+    }
+
+    raw_pos += n;
+    *br = n;
+    return FR_OK;
+}
+
+
+// -----------------------------------------------------------------------------
+// Non-blocking read for the audio ring. Whole sectors of a contiguous
+// track are submitted with SD_ReadAsync() straight into buf and land
+// while the caller keeps feeding the FPGA; anything else (FAT/CLMT
+// mode, the partial first and last sector) is a wav_read() done at
+// start. Poll until it stops returning 1: 0 is done with *br bytes (0 at
+// the end of the track), -1 an error. A submit or transfer that fails
+// above the 10 MHz baseline is retried one SD clock step slower, as
+// SD_ReadMultiBlock() does; -1 only once it failed at the baseline.
+// -----------------------------------------------------------------------------
+static int read_submit(void) {
+    uint8_t r;
+
+    while ((r = SD_ReadAsync(async_lba, async_buf, async_count, 0)) != SD_OK)
+        if (r != SD_BUSY && SD_StepDown() != SD_OK)
+            return -1;
+    async_busy = 1;
+    return 0;
+}
+
+int wav_read_start(BYTE* buf, UINT btr) {
+    FSIZE_t remain = f_size(&file) - raw_pos;
+
+    async_len = 0;
+    async_busy = 0;
+
+    if (raw_mode && raw_pos % 512 == 0 && btr >= 512 && remain >= 512) {
+        UINT count = btr / 512;
+        if (count > remain / 512) count = (UINT)(remain / 512);
+
+        async_lba = raw_lba + (LBA_t)(raw_pos / 512);
+        async_buf = buf;
+        async_count = count;
+        if (read_submit() != 0)
+            return -1;
+
+        async_len = count * 512;
+        raw_pos += async_len;
+        return 0;
+    }
+
+    return (wav_read(buf, btr, &async_len) == FR_OK) ? 0 : -1;
+}
+
+int wav_read_poll(UINT* br) {
+    if (async_busy) {
+        uint8_t r = SD_Poll();
+        if (r == SD_BUSY)
+            return 1;
+        async_busy = 0;
+        if (r != SD_OK)
+            return (SD_StepDown() == SD_OK && read_submit() == 0) ? 1 : -1;
+    }
+
+    *br = async_len;
+    async_len = 0;
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Forward audio data of the open track to func without copying it out
+// of the FatFs sector buffer (f_forward). Stops early, with FR_OK, when
+// func reports the stream busy; wav_eof() tells that apart from the end.
+// -----------------------------------------------------------------------------
+FRESULT wav_forward(UINT (*func)(const BYTE*, UINT), UINT btf, UINT* bf) {
+    FRESULT res;
+
+    // The raw path keeps its own position; bring the FIL along
+    if (raw_mode && f_tell(&file) != raw_pos) {
+        res = f_lseek(&file, raw_pos);
+        if (res != FR_OK)
+            return res;
+    }
+
+    res = f_forward(&file, func, btf, bf);
+
+    if (raw_mode)
+        raw_pos = f_tell(&file);
+    return res;
+}
+
+int wav_eof(void) {
+    return raw_mode ? (raw_pos >= f_size(&file)) : f_eof(&file);
+}
+
+int wav_stream_mode(void) {
+    if (raw_mode)
+        return WAV_MODE_RAW;
+    return file.cltbl ? WAV_MODE_CLMT : WAV_MODE_FAT;
+}
@@ -2,10 +2,128 @@
 #define WAV_H
 
 #include "ff.h"
-#include "main.h"   // For MAX_WAV_FILES and global declarations
+#include "main.h"   // For global declarations
+
+// Tracks held in RAM: the whole table for a small library, a window onto
+// the on-card index for a larger one. 12 bytes per track.
+#ifndef WAV_MAX_TRACKS
+#ifdef RAM_LEAN
+#define WAV_MAX_TRACKS 32
+#else
+#define WAV_MAX_TRACKS 256
+#endif
+#endif
+
+// Subdirectory levels scanned below WAV_LIBRARY_DIR (one DIR each)
+#ifndef WAV_SCAN_DEPTH
+#define WAV_SCAN_DEPTH 4
+#endif
+
+// Longest path the scanner and playlist reader handle
+#ifndef WAV_PATH_MAX
+#define WAV_PATH_MAX 256
+#endif
+
+// Fast-seek cluster link map for the open track, in DWORDs: two per
+// fragment plus two. A track with more fragments than fit falls back to
+// walking the FAT.
+#ifndef WAV_CLMT_ENTRIES
+#define WAV_CLMT_ENTRIES 64
+#endif
+
+// How the open track is read (wav_stream_mode)
+#define WAV_MODE_FAT    0   // f_read, cluster chain walked on the FAT
+#define WAV_MODE_CLMT   1   // f_read, clusters from the link map
+#define WAV_MODE_RAW    2   // contiguous: disk_read by absolute LBA
+
+// Compact track record: enough to reopen the file without its name. The
+// header is parsed when the track is opened, not when it is indexed.
+typedef struct {
+    DWORD sclust;       // first cluster
+    DWORD size;         // file size (a RIFF file stays under 4 GB)
+    BYTE  flags;        // WAV_TRACK_*
+    BYTE  reserved[3];
+} WAV_Track;
+
+#define WAV_TRACK_NOFATCHAIN 0x01   // exFAT: contiguous, the FAT is never read
+
+// Audio format of the open track, from its fmt and data chunks
+typedef struct {
+    DWORD sample_rate;
+    DWORD data_length;  // audio bytes, whole frames, within the file
+    WORD  format_tag;   // WAV_FORMAT_PCM or WAV_FORMAT_FLOAT (extensible resolved)
+    WORD  channels;
+    WORD  bits;         // per sample, container size
+    WORD  block_align;  // bytes per frame
+} WAV_Format;
+
+#define WAV_FORMAT_PCM          0x0001
+#define WAV_FORMAT_FLOAT        0x0003
+#define WAV_FORMAT_EXTENSIBLE   0xFFFE
+
+// Sample rates the TIM2 sample clock is set up for
+#define WAV_RATE_MIN 8000
+#define WAV_RATE_MAX 96000
+
+// Header bytes read at open: RIFF, an extensible fmt chunk, fact and the
+// data chunk header all fit. A chunk header past them (a LIST chunk
+// before data) costs one more read of the same size.
+#ifndef WAV_HEADER_READ
+#define WAV_HEADER_READ 96
+#endif
+
+// Chunks walked before data before a file is given up on
+#ifndef WAV_MAX_CHUNKS
+#define WAV_MAX_CHUNKS 16
+#endif
+
+// Directory scanned for tracks
+#ifndef WAV_LIBRARY_DIR
+#define WAV_LIBRARY_DIR "/"
+#endif
+
+// Playlist played instead of the library when present: M3U/M3U8, one
+// path per line, absolute or relative to the playlist, # lines ignored
+#ifndef WAV_PLAYLIST
+#define WAV_PLAYLIST "/PLAYLIST.M3U"
+#endif
+
+// On-card track index: header, then one WAV_Track per track. Valid
+// while the volume stamp (serial, FSInfo free/next cluster, library
+// directory time) matches; any file added, removed or resized moves it.
+// The index is the full table; RAM holds WAV_MAX_TRACKS of it at a time.
+#define WAV_INDEX_FILE      "/TRACKS.IDX"
+#define WAV_INDEX_MAGIC     0x58444957UL    // "WIDX"
+#define WAV_INDEX_VERSION   4
+
+typedef struct {
+    DWORD magic;        // written last: 0 marks an unfinished index
+    WORD  version;
+    WORD  record_size;  // sizeof(WAV_Track)
+    DWORD count;
+    DWORD vsn;          // volume serial number
+    DWORD free_clst;
+    DWORD last_clst;
+    DWORD dir_time;     // library directory fdate:ftime (0 for the root)
+} WAV_IndexHeader;
+
+extern WAV_Track wav_tracks[WAV_MAX_TRACKS];
+extern DWORD wav_track_count;
+extern int32_t current_track_index;
 
 // API
 void scan_wav_files(void);
+int load_track_index(void);
+int open_playlist(void);
 int open_next_wav_file(void);
+const WAV_Track* wav_current_track(void);
+const WAV_Format* wav_format(void);
+FRESULT wav_read(BYTE* buf, UINT btr, UINT* br);
+int wav_read_start(BYTE* buf, UINT btr);
+int wav_read_poll(UINT* br);
+FRESULT wav_forward(UINT (*func)(const BYTE*, UINT), UINT btf, UINT* bf);
+int wav_eof(void);
+int seek_wav_file(FSIZE_t offset);
+int wav_stream_mode(void);
 
 #endif